@@ -0,0 +1,94 @@
+// Compile-time feature configuration for the st7789 chip
+//
+// One source tree builds several chip variants. Pick one by defining
+// CHIP_VARIANT_MINIMAL, CHIP_VARIANT_FAST or CHIP_VARIANT_INSTRUMENTED
+// before including main.c (see src/variants/). Without a variant the
+// fast build is produced. Every CHIP_FEATURE_* switch can also be
+// overridden on its own with -D.
+//
+// SPDX-License-Identifier: MIT
+
+#ifndef CHIP_CONFIG_H
+#define CHIP_CONFIG_H
+
+#if defined(CHIP_VARIANT_MINIMAL)
+#define CHIP_VARIANT_NAME "minimal"
+#define CHIP_VARIANT_SPEED 0
+#define CHIP_VARIANT_DEBUG 0
+#elif defined(CHIP_VARIANT_INSTRUMENTED)
+#define CHIP_VARIANT_NAME "instrumented"
+#define CHIP_VARIANT_SPEED 1
+#define CHIP_VARIANT_DEBUG 1
+#else
+#define CHIP_VARIANT_NAME "fast"
+#define CHIP_VARIANT_SPEED 1
+#define CHIP_VARIANT_DEBUG 0
+#endif
+
+/* Shadow GRAM inside the chip, flushed to the host as batched row spans */
+#ifndef CHIP_FEATURE_GRAM
+#define CHIP_FEATURE_GRAM CHIP_VARIANT_SPEED
+#endif
+
+/* Vectorized RGB565 -> RGBA span conversion (needs CHIP_FEATURE_GRAM) */
+#ifndef CHIP_FEATURE_SIMD
+#define CHIP_FEATURE_SIMD CHIP_VARIANT_SPEED
+#endif
+
+/* Init-sequence driver fingerprinting that selects a tuned pipeline profile */
+#ifndef CHIP_FEATURE_PROFILES
+#define CHIP_FEATURE_PROFILES CHIP_VARIANT_SPEED
+#endif
+
+/* Downscaled RGBA thumbnail maintained on present and printed periodically */
+#ifndef CHIP_FEATURE_THUMBNAIL
+#define CHIP_FEATURE_THUMBNAIL CHIP_VARIANT_SPEED
+#endif
+
+/* Built-in self-benchmark, enabled at runtime with the selfBenchmark attr */
+#ifndef CHIP_FEATURE_BENCH
+#define CHIP_FEATURE_BENCH CHIP_VARIANT_SPEED
+#endif
+
+/* Counters printed periodically to stdout */
+#ifndef CHIP_FEATURE_STATS
+#define CHIP_FEATURE_STATS CHIP_VARIANT_DEBUG
+#endif
+
+/* Per-command trace lines, enabled at runtime with the trace attr */
+#ifndef CHIP_FEATURE_TRACE
+#define CHIP_FEATURE_TRACE CHIP_VARIANT_DEBUG
+#endif
+
+/* Chrome trace-event timeline on stdout, enabled at runtime with the timeline attr */
+#ifndef CHIP_FEATURE_TIMELINE
+#define CHIP_FEATURE_TIMELINE CHIP_VARIANT_DEBUG
+#endif
+
+/* Per-frame traffic summary lines, enabled at runtime with the frameLog attr */
+#ifndef CHIP_FEATURE_FRAME_LOG
+#define CHIP_FEATURE_FRAME_LOG CHIP_VARIANT_DEBUG
+#endif
+
+/* Report of init delays against the datasheet minimums, enabled with the bootReport attr */
+#ifndef CHIP_FEATURE_BOOT_REPORT
+#define CHIP_FEATURE_BOOT_REPORT CHIP_VARIANT_DEBUG
+#endif
+
+#if CHIP_FEATURE_SIMD && !CHIP_FEATURE_GRAM
+#error "CHIP_FEATURE_SIMD requires CHIP_FEATURE_GRAM"
+#endif
+
+#if CHIP_FEATURE_PROFILES && !CHIP_FEATURE_GRAM
+#error "CHIP_FEATURE_PROFILES requires CHIP_FEATURE_GRAM"
+#endif
+
+#if CHIP_FEATURE_THUMBNAIL && !CHIP_FEATURE_GRAM
+#error "CHIP_FEATURE_THUMBNAIL requires CHIP_FEATURE_GRAM"
+#endif
+
+#if CHIP_FEATURE_TIMELINE && !CHIP_FEATURE_STATS
+#error "CHIP_FEATURE_TIMELINE requires CHIP_FEATURE_STATS"
+#endif
+
+#endif /* CHIP_CONFIG_H */
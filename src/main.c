@@ -5,28 +5,250 @@
 // SPDX-License-Identifier: MIT
 // Copyright (C) 2022 Uri Shaked / wokwi.com
 
+#include "chip-config.h"
 #include "wokwi-api.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 typedef enum {
   MODE_COMMAND = 0,
   MODE_DATA = 1,
 } chip_mode_t;
 
+/*
+ * Sibling controllers that share the CASET/RASET/RAMWR/MADCTL model. What
+ * differs between them is described here, so every controller runs the same
+ * pixel pipeline.
+ */
 typedef struct {
+  const char *name;
+  const uint8_t *commands;     // CMD_ARGS(n) per opcode, 0 if the controller lacks it
+  uint16_t gram_width;         // GRAM size of the controller, panels may use part of it
+  uint16_t gram_height;
+  uint16_t mirror_row_offset;  // subtracted from RASET addresses while MY is set
+  uint8_t color_formats;       // COLOR_* accepted by COLMOD
+  bool pwctr1_resets;          // IL9163 heritage: PWCTR1 resets the address window
+} controller_t;
+
+#if CHIP_FEATURE_STATS
+typedef struct {
+  uint64_t bytes;
+  uint64_t commands;
+  uint64_t windows;
+  uint64_t pixels;
+  uint64_t host_writes;
+  uint64_t profile_switches;
+  uint64_t presents;
+  uint64_t tile_hits;
+  uint64_t tile_misses;
+  uint64_t tile_host_reads;
+  uint64_t tile_early_writes;
+} chip_stats_t;
+#endif
+
+#if CHIP_FEATURE_GRAM
+/* When the dirty part of GRAM is written back to the host framebuffer */
+typedef enum {
+  PRESENT_CHUNK = 0,  // after every SPI transfer
+  PRESENT_WINDOW,     // when a pixel write ends (next command or CS high)
+  PRESENT_DEFERRED,   // on a fixed simulated-time period
+  PRESENT_FRAME,      // tear-free: only at frame boundaries, in one host write
+} present_policy_t;
+
+/* Where a GRAM tile lives while it is not in the tile cache */
+typedef enum {
+  TILE_SOLID = 0,  // one color
+  TILE_RLE,        // compressed runs
+  TILE_HOST,       // only in the host framebuffer
+} tile_store_t;
+
+typedef struct {
+  uint32_t *runs;      // TILE_RLE: (length - 1) << 24 | RGB for each run
+  uint32_t color;      // TILE_SOLID
+  uint16_t run_count;
+  uint16_t slot;       // cache slot, or TILE_NO_SLOT
+  uint8_t store;       // tile_store_t
+  bool pending;        // written since the last present; only cached tiles can be pending
+} gram_tile_t;
+
+/* Low-memory GRAM: a fixed number of cached tiles, the rest compressed or on the host */
+typedef struct {
+  gram_tile_t *tiles;
+  uint32_t *pixels;    // slots tiles of TILE_PIXELS each
+  uint16_t *slot_tile;
+  uint8_t *referenced;
+  uint32_t slots;
+  uint32_t slots_used;
+  uint32_t hand;       // clock eviction position
+  uint32_t compressed_bytes;
+  uint32_t compressed_budget;
+  uint32_t *row;       // scratch row for presents
+} tile_cache_t;
+
+/* SPI transfer size and present policy tuned for one kind of traffic */
+typedef struct {
+  const char *name;
+  present_policy_t present;
+  uint32_t spi_chunk;
+} pipeline_profile_t;
+#endif
+
+#if CHIP_FEATURE_GRAM && CHIP_FEATURE_PROFILES
+#define SPI_BUFFER_SIZE (16384)
+#define FINGERPRINT_LENGTH (32)
+#else
+#define SPI_BUFFER_SIZE (2048)
+#endif
+
+#if CHIP_FEATURE_PROFILES
+/* Traffic shape, as moving averages with 4 fractional bits */
+typedef struct {
+  uint32_t window_pixels;   // pixels in the current window
+  uint32_t cs_bytes;        // bytes in the current CS transaction
+  uint32_t cs_toggles;      // DC toggles in the current CS transaction
+  uint32_t avg_window;
+  uint32_t avg_cs_bytes;
+  uint32_t avg_toggles;
+  uint64_t last_decision_ns;
+  uint8_t candidate;
+  uint8_t votes;
+} autotune_t;
+#endif
+
+#if CHIP_FEATURE_TIMELINE
+#define TIMELINE_CAPACITY (4096)
+
+typedef enum {
+  TIMELINE_CS = 0,   // CS transaction (complete event)
+  TIMELINE_WINDOW,   // pixel write window (complete event)
+  TIMELINE_COMMAND,  // command executed (instant)
+  TIMELINE_PRESENT,  // GRAM written back to the host (instant)
+} timeline_type_t;
+
+typedef struct {
+  uint64_t ts;   // simulated ns
+  uint64_t dur;
+  uint32_t arg;
+  uint8_t type;
+  uint8_t code;
+} timeline_event_t;
+
+/* Preallocated event buffer, printed as trace-event JSON when full or on the stats timer */
+typedef struct {
+  timeline_event_t events[TIMELINE_CAPACITY];
+  uint32_t count;
+  bool started;
+  uint64_t cs_start;
+  uint64_t window_start;
+  uint32_t window_pixels;
+  uint32_t cs_bytes;
+  uint8_t window_code;
+  bool window_open;
+} timeline_t;
+#endif
+
+#if CHIP_FEATURE_FRAME_LOG
+/* Pixel write windows by size relative to the panel */
+enum {
+  WINDOW_TINY = 0,  // up to 16 pixels, per-pixel drawing
+  WINDOW_PARTIAL,
+  WINDOW_FULL,      // the whole panel
+  WINDOW_CLASSES,
+};
+
+/* Traffic of the frame in progress */
+typedef struct {
+  uint64_t start_ns;
+  uint32_t number;
+  uint32_t bytes;
+  uint32_t commands;
+  uint32_t windows[WINDOW_CLASSES];
+  uint32_t window_bytes[WINDOW_CLASSES];
+  uint8_t window_class;
+  bool pixels;
+} frame_log_t;
+#endif
+
+#if CHIP_FEATURE_BOOT_REPORT
+#define BOOT_WAITS (8)
+
+/* Time between a command that needs a settle delay and the command after it */
+typedef struct {
+  uint8_t command;
+  uint8_t next;
+  uint64_t waited_ns;
+} boot_wait_t;
+
+/* Waits seen between reset and the first RAMWR */
+typedef struct {
+  bool enabled;
+  bool done;
+  bool waiting;
+  uint8_t pending;
+  uint64_t pending_ns;
+  uint64_t start_ns;
+  boot_wait_t waits[BOOT_WAITS];
+  uint8_t count;
+} boot_report_t;
+#endif
+
+typedef enum {
+  RLE_HEADER = 0,
+  RLE_RUN,
+  RLE_LITERAL,
+} rle_phase_t;
+
+/* Decoder state for the RLEWR pixel stream, kept across SPI transfers */
+typedef struct {
+  rle_phase_t phase;
+  uint32_t remaining;
+  uint16_t header;
+  uint8_t header_bytes;
+  uint16_t pixel;
+  uint8_t pixel_bytes;
+} rle_state_t;
+
+/* Counters firmware can read with PERFRD, kept in every build */
+typedef struct {
+  uint32_t bytes;
+  uint32_t pixels;
+  uint32_t redundant_pixels;  // pixels rewritten with the color they had (GRAM builds)
+  uint32_t windows;
+  uint32_t presents;
+  uint64_t busy_ns;           // time with CS low
+  uint64_t select_ns;
+  bool selected;
+} perf_counters_t;
+
+typedef struct {
+  const controller_t *controller;
   pin_t    cs_pin;
   pin_t    dc_pin;
   pin_t    rst_pin;
   spi_dev_t spi;
-  uint8_t  spi_buffer[2048];
+  uint8_t  spi_buffer[SPI_BUFFER_SIZE];
+  uint32_t spi_chunk;
 
   /* Framebuffer state */
   buffer_t framebuffer;
+  uint32_t fb_width;
+  uint32_t fb_height;
+
+  /* Panel (GRAM) size and its placement on the host framebuffer */
   uint32_t width;
   uint32_t height;
+  uint32_t scale;
+  int32_t offset_x;
+  int32_t offset_y;
+  uint32_t visible_x0;
+  uint32_t visible_x1;
+  uint32_t visible_y0;
+  uint32_t visible_y1;
+  int32_t *row_base;   // per panel row: host pixel index of panel column 0
+  uint32_t *host_row;  // scratch row of fb_width pixels
 
   /* Command state machine */
   chip_mode_t mode;
@@ -36,6 +258,24 @@ typedef struct {
   uint8_t command_buf[16];
   bool ram_write;
 
+  /* RAMWR pixel format from COLMOD, and a pixel split across SPI transfers */
+  uint8_t pixel_bytes;
+  uint8_t pixel_carry[3];
+  uint8_t pixel_carry_length;
+
+  /* Vendor extensions (opt-in with the vendorCommands attr) */
+  bool vendor_commands;
+  bool rle_write;
+  rle_state_t rle;
+  uint32_t memwr_symbol;
+
+  perf_counters_t perf;
+
+  /* Bytes to shift out on SDO with the next SPI transfer */
+  uint8_t response[32];
+  uint8_t response_length;
+  bool response_armed;
+
   // Memory and addressing settings
   uint32_t active_column;
   uint32_t active_page;
@@ -44,8 +284,98 @@ typedef struct {
   uint32_t page_start;
   uint32_t page_end;
   uint32_t scanning_direction;
+
+#if CHIP_FEATURE_GRAM
+  /* Shadow of the host framebuffer and the area not yet written back */
+  uint32_t *gram;
+  uint32_t dirty_x0;
+  uint32_t dirty_y0;
+  uint32_t dirty_x1;
+  uint32_t dirty_y1;
+
+  /* CRC32 of each GRAM tile, recomputed only after the tile was written */
+  uint32_t tiles_x;
+  uint32_t tiles_y;
+  uint32_t *tile_crc;
+  uint8_t *tile_valid;
+
+  const pipeline_profile_t *profile;
+  present_policy_t present_policy;
+  timer_t present_timer;
+  bool tear_free;
+  bool window_wrapped;   // the write pointer wrapped around the window
+  bool frame_presented;  // a frame boundary was presented since the last timer tick
+  uint32_t *staging;     // host-format rows for tear-free presents with scaling or borders
+  tile_cache_t *tile_cache;  // replaces gram in low-memory mode (gramBudgetKB attr)
+#endif
+
+#if CHIP_FEATURE_THUMBNAIL
+  /* 1/4 or 1/8 scale RGBA copy of the panel, refreshed on present */
+  uint32_t thumbnail_shift;
+  uint32_t thumbnail_width;
+  uint32_t thumbnail_height;
+  uint8_t *thumbnail;
+  bool thumbnail_changed;
+  timer_t thumbnail_timer;
+#endif
+
+#if CHIP_FEATURE_PROFILES
+  /* Opcodes seen since reset, matched against known drivers at the first RAMWR */
+  uint8_t init_sequence[FINGERPRINT_LENGTH];
+  uint8_t init_length;
+  bool fingerprinted;
+
+  bool autotune_enabled;
+  autotune_t autotune;
+#endif
+
+#if CHIP_FEATURE_STATS
+  chip_stats_t stats;
+  chip_stats_t stats_reported;
+  timer_t stats_timer;
+#endif
+
+#if CHIP_FEATURE_TRACE
+  bool trace;
+#endif
+
+#if CHIP_FEATURE_TIMELINE
+  timeline_t *timeline;
+#endif
+
+#if CHIP_FEATURE_BOOT_REPORT
+  boot_report_t boot;
+#endif
+
+#if CHIP_FEATURE_FRAME_LOG
+  frame_log_t *frame_log;
+#endif
 } chip_state_t;
 
+#if CHIP_FEATURE_STATS
+#define CHIP_STAT_ADD(chip, counter, n) ((chip)->stats.counter += (n))
+#else
+#define CHIP_STAT_ADD(chip, counter, n) ((void)(chip), (void)(n))
+#endif
+
+#if CHIP_FEATURE_TRACE
+#define CHIP_TRACE(chip, ...) do { if ((chip)->trace) printf(__VA_ARGS__); } while (0)
+#else
+#define CHIP_TRACE(chip, ...) ((void)0)
+#endif
+
+#if CHIP_FEATURE_TIMELINE
+#define CHIP_TIMELINE(chip, call) do { if ((chip)->timeline) call; } while (0)
+#else
+#define CHIP_TIMELINE(chip, call) ((void)0)
+#endif
+
+#if CHIP_FEATURE_FRAME_LOG
+#define CHIP_FRAME_LOG(chip, call) do { if ((chip)->frame_log) call; } while (0)
+#else
+#define CHIP_FRAME_LOG(chip, call) ((void)0)
+#endif
+
 /* Chip command codes */
 #define CMD_NOP      (0x00)
 #define CMD_SWRESET  (0x01)
@@ -73,32 +403,455 @@ typedef struct {
 #define CMD_VMCTR    (0xc5)
 #define CMD_GMCTRP1  (0xe0)
 #define CMD_GMCTRN1  (0xe1)
+#define CMD_NORON    (0x13)
+
+/* Vendor commands, not used by the ST7789 itself */
+#define CMD_RLEWR    (0xf1)
+#define CMD_MEMWR    (0xf2)
+#define CMD_CRCRD    (0xf3)
+#define CMD_PERFRD   (0xf4)
+#define CMD_RECTCP   (0xf5)
+
+/* PERFRD flags */
+#define PERFRD_CLEAR (0x01)
+
+/* MEMWR source pixel formats */
+#define MEMWR_RGB565_BE (0)
+#define MEMWR_RGB565_LE (1)
+
+/* COLMOD pixel formats (low nibble of the argument) */
+#define COLMOD_RGB565 (0x05)
+#define COLMOD_RGB666 (0x06)
+#define COLOR_RGB565  (1 << COLMOD_RGB565)
+#define COLOR_RGB666  (1 << COLMOD_RGB666)
+
+/* Command table entries: the opcode exists and takes n argument bytes */
+#define CMD_KNOWN   (0x80)
+#define CMD_ARGS(n) (CMD_KNOWN | (n))
+
+static const uint8_t st7789_commands[256] = {
+  [CMD_NOP]     = CMD_ARGS(0),  [CMD_SWRESET] = CMD_ARGS(0),  [CMD_SLPIN]   = CMD_ARGS(0),
+  [CMD_SLPOUT]  = CMD_ARGS(0),  [CMD_NORON]   = CMD_ARGS(0),  [CMD_INVOFF]  = CMD_ARGS(0),
+  [CMD_INVON]   = CMD_ARGS(0),  [CMD_DISPOFF] = CMD_ARGS(0),  [CMD_DISPON]  = CMD_ARGS(0),
+  [CMD_CASET]   = CMD_ARGS(4),  [CMD_RASET]   = CMD_ARGS(4),  [CMD_RAMWR]   = CMD_ARGS(0),
+  [CMD_MADCTL]  = CMD_ARGS(1),  [CMD_COLMOD]  = CMD_ARGS(1),  [CMD_FRMCTR1] = CMD_ARGS(3),
+  [CMD_FRMCTR2] = CMD_ARGS(3),  [CMD_FRMCTR3] = CMD_ARGS(6),  [CMD_INVCTR]  = CMD_ARGS(1),
+  [CMD_DISSET5] = CMD_ARGS(2),  [CMD_PWCTR1]  = CMD_ARGS(3),  [CMD_PWCTR2]  = CMD_ARGS(1),
+  [CMD_PWCTR3]  = CMD_ARGS(2),  [CMD_PWCTR4]  = CMD_ARGS(2),  [CMD_PWCTR5]  = CMD_ARGS(2),
+  [CMD_VMCTR]   = CMD_ARGS(1),  [CMD_GMCTRP1] = CMD_ARGS(16), [CMD_GMCTRN1] = CMD_ARGS(16),
+};
+
+static const uint8_t ili9341_commands[256] = {
+  [CMD_NOP]     = CMD_ARGS(0),  [CMD_SWRESET] = CMD_ARGS(0),  [CMD_SLPIN]   = CMD_ARGS(0),
+  [CMD_SLPOUT]  = CMD_ARGS(0),  [CMD_NORON]   = CMD_ARGS(0),  [CMD_INVOFF]  = CMD_ARGS(0),
+  [CMD_INVON]   = CMD_ARGS(0),  [CMD_DISPOFF] = CMD_ARGS(0),  [CMD_DISPON]  = CMD_ARGS(0),
+  [CMD_CASET]   = CMD_ARGS(4),  [CMD_RASET]   = CMD_ARGS(4),  [CMD_RAMWR]   = CMD_ARGS(0),
+  [CMD_MADCTL]  = CMD_ARGS(1),  [CMD_COLMOD]  = CMD_ARGS(1),  [CMD_FRMCTR1] = CMD_ARGS(2),
+  [CMD_INVCTR]  = CMD_ARGS(1),  [CMD_PWCTR1]  = CMD_ARGS(1),  [CMD_PWCTR2]  = CMD_ARGS(1),
+  [CMD_VMCTR]   = CMD_ARGS(2),  [CMD_GMCTRP1] = CMD_ARGS(15), [CMD_GMCTRN1] = CMD_ARGS(15),
+  [0x26] = CMD_ARGS(1),  // gamma set
+  [0x33] = CMD_ARGS(6),  // vertical scrolling definition
+  [0x37] = CMD_ARGS(2),  // vertical scrolling start
+  [0xb6] = CMD_ARGS(3),  // display function control
+  [0xc7] = CMD_ARGS(1),  // VCOM control 2
+  [0xcb] = CMD_ARGS(5),  // power control A
+  [0xcf] = CMD_ARGS(3),  // power control B
+  [0xe8] = CMD_ARGS(3),  // driver timing control A
+  [0xea] = CMD_ARGS(2),  // driver timing control B
+  [0xed] = CMD_ARGS(4),  // power on sequence control
+  [0xef] = CMD_ARGS(3),  // undocumented, sent by most drivers
+  [0xf2] = CMD_ARGS(1),  // 3-gamma enable
+  [0xf7] = CMD_ARGS(1),  // pump ratio control
+};
+
+static const uint8_t gc9a01_commands[256] = {
+  [CMD_NOP]     = CMD_ARGS(0),  [CMD_SWRESET] = CMD_ARGS(0),  [CMD_SLPIN]   = CMD_ARGS(0),
+  [CMD_SLPOUT]  = CMD_ARGS(0),  [CMD_NORON]   = CMD_ARGS(0),  [CMD_INVOFF]  = CMD_ARGS(0),
+  [CMD_INVON]   = CMD_ARGS(0),  [CMD_DISPOFF] = CMD_ARGS(0),  [CMD_DISPON]  = CMD_ARGS(0),
+  [CMD_CASET]   = CMD_ARGS(4),  [CMD_RASET]   = CMD_ARGS(4),  [CMD_RAMWR]   = CMD_ARGS(0),
+  [CMD_MADCTL]  = CMD_ARGS(1),  [CMD_COLMOD]  = CMD_ARGS(1),
+  [0x35] = CMD_ARGS(0),  // tearing effect on (drivers send it without the argument)
+  [0x62] = CMD_ARGS(12), [0x63] = CMD_ARGS(12), [0x64] = CMD_ARGS(7),
+  [0x66] = CMD_ARGS(10), [0x67] = CMD_ARGS(10), [0x70] = CMD_ARGS(9),
+  [0x74] = CMD_ARGS(7),  [0x84] = CMD_ARGS(1),  [0x85] = CMD_ARGS(1),
+  [0x86] = CMD_ARGS(1),  [0x87] = CMD_ARGS(1),  [0x88] = CMD_ARGS(1),
+  [0x89] = CMD_ARGS(1),  [0x8a] = CMD_ARGS(1),  [0x8b] = CMD_ARGS(1),
+  [0x8c] = CMD_ARGS(1),  [0x8d] = CMD_ARGS(1),  [0x8e] = CMD_ARGS(1),
+  [0x8f] = CMD_ARGS(1),  [0x90] = CMD_ARGS(4),  [0x98] = CMD_ARGS(2),
+  [0xae] = CMD_ARGS(1),  [0xb6] = CMD_ARGS(2),  [0xbc] = CMD_ARGS(1),
+  [0xbd] = CMD_ARGS(1),  [0xbe] = CMD_ARGS(1),  [0xc3] = CMD_ARGS(1),
+  [0xc4] = CMD_ARGS(1),  [0xc9] = CMD_ARGS(1),  [0xcd] = CMD_ARGS(1),
+  [0xdf] = CMD_ARGS(3),  [0xe1] = CMD_ARGS(2),  [0xe8] = CMD_ARGS(1),
+  [0xeb] = CMD_ARGS(1),  [0xed] = CMD_ARGS(2),  [0xef] = CMD_ARGS(0),
+  [0xf0] = CMD_ARGS(6),  [0xf1] = CMD_ARGS(6),  [0xf2] = CMD_ARGS(6),
+  [0xf3] = CMD_ARGS(6),  [0xfe] = CMD_ARGS(0),  [0xff] = CMD_ARGS(3),
+};
+
+static const controller_t controllers[] = {
+  { "st7789",  st7789_commands,  240, 320, 32, COLOR_RGB565 | COLOR_RGB666, true },
+  // The command set above was inherited from the ST7735/IL9163 family
+  { "st7735",  st7789_commands,  132, 162, 32, COLOR_RGB565 | COLOR_RGB666, true },
+  { "ili9341", ili9341_commands, 240, 320, 0,  COLOR_RGB565 | COLOR_RGB666, false },
+  { "gc9a01",  gc9a01_commands,  240, 240, 0,  COLOR_RGB565 | COLOR_RGB666, false },
+};
+
+/* GRAM tiles for CRC readback are (1 << TILE_SHIFT) pixels square */
+#define TILE_SHIFT (4)
+#define TILE_MASK ((1 << TILE_SHIFT) - 1)
+#define TILE_PIXELS (1 << (2 * TILE_SHIFT))
+#define TILE_NO_SLOT (0xffff)
 
 /* Scanning direction bits */
 #define SCAN_MY (0b10000000)
 #define SCAN_MX (0b01000000)
 #define SCAN_MV (0b00100000)
 
+#if CHIP_FEATURE_GRAM
+#define PRESENT_DEFERRED_US (16667)
+/* Tear-free mode publishes anyway if no frame boundary shows up for this long */
+#define PRESENT_FRAME_TIMEOUT_US (100000)
+
+enum {
+  PROFILE_DEFAULT = 0,
+  PROFILE_PIXEL,
+  PROFILE_BLOCK,
+  PROFILE_PARTIAL,
+};
+
+static const pipeline_profile_t pipeline_profiles[] = {
+  [PROFILE_DEFAULT] = { "default",           PRESENT_CHUNK,    2048 },
+  [PROFILE_PIXEL]   = { "per-pixel windows", PRESENT_DEFERRED, 2048 },
+  [PROFILE_BLOCK]   = { "block pushes",      PRESENT_WINDOW,   16384 },
+  [PROFILE_PARTIAL] = { "partial flushes",   PRESENT_WINDOW,   8192 },
+};
+#endif
+
+#if CHIP_FEATURE_PROFILES
+/*
+ * Init sequences of common driver libraries. A signature matches when its
+ * opcodes appear in this order in the commands received before the first
+ * RAMWR; the longest matching signature wins.
+ */
+typedef struct {
+  const char *driver;
+  uint8_t profile;
+  uint8_t length;
+  uint8_t opcodes[16];
+} driver_signature_t;
+
+static const driver_signature_t driver_signatures[] = {
+  { "Adafruit_ST7789", PROFILE_PIXEL, 8,
+    { 0x01, 0x11, 0x3a, 0x36, 0x2a, 0x2b, 0x21, 0x13 } },
+  { "TFT_eSPI", PROFILE_BLOCK, 9,
+    { 0x11, 0xb2, 0xb7, 0xbb, 0xc6, 0xd0, 0xe0, 0xe1, 0x29 } },
+  { "LVGL esp32 drivers", PROFILE_PARTIAL, 6,
+    { 0xcf, 0xed, 0xe8, 0xcb, 0xf7, 0xea } },
+};
+#endif
+
 static void chip_pin_change(void *user_data, pin_t pin, uint32_t value);
 static void chip_spi_done(void *user_data, uint8_t *buffer, uint32_t count);
+static void chip_clear_framebuffer(chip_state_t *chip);
+#if CHIP_FEATURE_TIMELINE
+static void timeline_add(chip_state_t *chip, timeline_type_t type, uint64_t ts, uint64_t dur, uint32_t arg, uint8_t code);
+static void timeline_window_begin(chip_state_t *chip, uint8_t code);
+static void timeline_window_end(chip_state_t *chip);
+#endif
+#if CHIP_FEATURE_THUMBNAIL
+static void thumbnail_update(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1);
+static void thumbnail_timer(void *user_data);
+#endif
+#if CHIP_FEATURE_GRAM
+static bool tile_cache_init(chip_state_t *chip, uint32_t budget);
+static void chip_present(chip_state_t *chip);
+static void chip_present_timer(void *user_data);
+#endif
+void process_data(chip_state_t *chip, const uint8_t *buf, uint32_t byte_count);
+#if CHIP_FEATURE_BENCH
+static void chip_self_benchmark(chip_state_t *chip, uint32_t iterations, uint32_t spi_mhz);
+#endif
+#if CHIP_FEATURE_STATS
+static void chip_stats_timer(void *user_data);
+#endif
+#if CHIP_FEATURE_FRAME_LOG
+static void frame_log_window(chip_state_t *chip);
+static void frame_log_boundary(chip_state_t *chip);
+#endif
+
+static inline bool command_is_vendor(uint8_t command_code) {
+  return command_code == CMD_RLEWR || command_code == CMD_MEMWR || command_code == CMD_CRCRD ||
+         command_code == CMD_PERFRD || command_code == CMD_RECTCP;
+}
+
+/* Vendor commands that answer on SDO right after their arguments */
+static inline bool command_has_response(uint8_t command_code) {
+  return command_code == CMD_CRCRD || command_code == CMD_PERFRD;
+}
 
 void chip_reset(chip_state_t *chip) {
   chip->ram_write = false;
+  chip->rle_write = false;
   chip->active_column = 0;
   chip->active_page = 0;
   chip->column_start = 0;
   chip->page_start = 0;
-  // Use the framebuffer dimensions so address ranges match the actual display
-  if (chip->width > 0 && chip->height > 0) {
-    chip->column_end = chip->width - 1;
-    chip->page_end = chip->height - 1;
+  // Use the panel dimensions so address ranges match the actual display
+  chip->column_end = chip->width - 1;
+  chip->page_end = chip->height - 1;
+  chip->scanning_direction = 0;
+}
+
+/*
+ * Place the panel on the host framebuffer: 1:1 when the sizes agree, otherwise
+ * the largest integer scale that fits, centered (cropped when the panel is
+ * larger). The per-row destination table keeps the mapping off the pixel path.
+ */
+static void chip_setup_mapping(chip_state_t *chip) {
+  uint32_t scale_x = chip->fb_width / chip->width;
+  uint32_t scale_y = chip->fb_height / chip->height;
+  chip->scale = scale_x < scale_y ? scale_x : scale_y;
+  if (!chip->scale) chip->scale = 1;
+  uint32_t scale = chip->scale;
+
+  chip->offset_x = ((int32_t)chip->fb_width - (int32_t)(chip->width * scale)) / 2;
+  chip->offset_y = ((int32_t)chip->fb_height - (int32_t)(chip->height * scale)) / 2;
+  chip->visible_x0 = chip->offset_x < 0 ? ((uint32_t)-chip->offset_x + scale - 1) / scale : 0;
+  chip->visible_y0 = chip->offset_y < 0 ? ((uint32_t)-chip->offset_y + scale - 1) / scale : 0;
+  chip->visible_x1 = ((int32_t)chip->fb_width - chip->offset_x - (int32_t)scale) / (int32_t)scale;
+  chip->visible_y1 = ((int32_t)chip->fb_height - chip->offset_y - (int32_t)scale) / (int32_t)scale;
+  if (chip->visible_x1 > chip->width - 1) chip->visible_x1 = chip->width - 1;
+  if (chip->visible_y1 > chip->height - 1) chip->visible_y1 = chip->height - 1;
+
+  chip->row_base = malloc(chip->height * sizeof(int32_t));
+  for (uint32_t y = 0; y < chip->height; y++) {
+    chip->row_base[y] = ((int32_t)(y * scale) + chip->offset_y) * (int32_t)chip->fb_width + chip->offset_x;
+  }
+  chip->host_row = malloc(chip->fb_width * sizeof(uint32_t));
+
+  const char *mapping = "exact";
+  if (chip->width != chip->fb_width || chip->height != chip->fb_height) {
+    mapping = chip->offset_x || chip->offset_y ? "centered" : "scaled";
+  }
+  printf("st7789: %ux%u panel on %ux%u framebuffer, %s mapping, scale %u\n",
+         chip->width, chip->height, chip->fb_width, chip->fb_height, mapping, scale);
+}
+
+#if CHIP_FEATURE_GRAM
+static void chip_apply_profile(chip_state_t *chip, const pipeline_profile_t *profile) {
+  chip->profile = profile;
+  chip->spi_chunk = profile->spi_chunk;
+  chip->present_policy = chip->tear_free ? PRESENT_FRAME : profile->present;
+  if (chip->present_policy == PRESENT_DEFERRED) {
+    timer_start(chip->present_timer, PRESENT_DEFERRED_US, true);
+  } else if (chip->present_policy == PRESENT_FRAME) {
+    timer_start(chip->present_timer, PRESENT_FRAME_TIMEOUT_US, true);
   } else {
-    chip->column_end = 127;
-    chip->page_end = 127;
+    timer_stop(chip->present_timer);
+    chip_present(chip);
   }
-  chip->scanning_direction = 0;
 }
 
+static void chip_present_timer(void *user_data) {
+  chip_state_t *chip = (chip_state_t*)user_data;
+  if (chip->present_policy == PRESENT_FRAME && chip->frame_presented) {
+    chip->frame_presented = false;
+    return;
+  }
+  chip_present(chip);
+}
+
+/* Present at a frame boundary: CS high after a pixel write, or a full-panel window completed */
+static void chip_present_frame(chip_state_t *chip) {
+  chip->window_wrapped = false;
+  chip->frame_presented = true;
+  chip_present(chip);
+}
+
+static inline bool chip_window_is_full_panel(chip_state_t *chip) {
+  return chip->column_end >= chip->column_start && chip->page_end >= chip->page_start &&
+         (chip->column_end - chip->column_start + 1) * (chip->page_end - chip->page_start + 1) >=
+         chip->width * chip->height;
+}
+#endif
+
+#if CHIP_FEATURE_PROFILES
+static void chip_fingerprint_driver(chip_state_t *chip) {
+  const driver_signature_t *best = NULL;
+  for (uint32_t s = 0; s < sizeof(driver_signatures) / sizeof(driver_signatures[0]); s++) {
+    const driver_signature_t *signature = &driver_signatures[s];
+    uint32_t matched = 0;
+    for (uint32_t i = 0; i < chip->init_length && matched < signature->length; i++) {
+      if (chip->init_sequence[i] == signature->opcodes[matched]) matched++;
+    }
+    if (matched == signature->length && (!best || signature->length > best->length)) {
+      best = signature;
+    }
+  }
+
+  const pipeline_profile_t *profile = &pipeline_profiles[best ? best->profile : PROFILE_DEFAULT];
+  chip_apply_profile(chip, profile);
+  static const char *const present_names[] = { "per transfer", "per window", "deferred", "per frame" };
+  printf("st7789: driver %s, profile %s (present %s, %u-byte SPI transfers)\n",
+         best ? best->driver : "unknown", profile->name, present_names[chip->present_policy], profile->spi_chunk);
+}
+
+static void chip_record_command(chip_state_t *chip, uint8_t command_code) {
+  if (chip->fingerprinted) return;
+  if (command_code == CMD_RAMWR) {
+    chip->fingerprinted = true;
+    chip_fingerprint_driver(chip);
+    return;
+  }
+  if (chip->init_length < FINGERPRINT_LENGTH) {
+    chip->init_sequence[chip->init_length++] = command_code;
+  }
+}
+
+/*
+ * Auto-tuner: at most once per frame period, at the end of a CS transaction,
+ * pick the profile that fits the averaged traffic. A new profile must win
+ * AUTOTUNE_VOTES decisions in a row before it is applied, and the thresholds
+ * widen in favour of the current profile.
+ */
+#define AUTOTUNE_PERIOD_NS (16666667ull)
+#define AUTOTUNE_VOTES     (3)
+
+static inline void autotune_average(uint32_t *average, uint32_t sample) {
+  // alpha = 1/8
+  *average = *average - (*average >> 3) + ((sample << 4) >> 3);
+}
+
+static void autotune_end_window(chip_state_t *chip) {
+  autotune_t *tune = &chip->autotune;
+  if (!tune->window_pixels) return;
+  autotune_average(&tune->avg_window, tune->window_pixels);
+  tune->window_pixels = 0;
+}
+
+static uint8_t autotune_choose(chip_state_t *chip, uint8_t current) {
+  const autotune_t *tune = &chip->autotune;
+  uint32_t window = tune->avg_window >> 4;
+  uint32_t cs_bytes = tune->avg_cs_bytes >> 4;
+  uint32_t toggles = tune->avg_toggles >> 4;
+
+  // Tiny windows, or DC switching every few bytes: per-pixel drawing
+  if (window <= (current == PROFILE_PIXEL ? 64u : 16u) || cs_bytes < toggles * 8) {
+    return PROFILE_PIXEL;
+  }
+  if (window >= (current == PROFILE_BLOCK ? 2048u : 4096u) ||
+      cs_bytes >= (current == PROFILE_BLOCK ? 4096u : 8192u)) {
+    return PROFILE_BLOCK;
+  }
+  return PROFILE_PARTIAL;
+}
+
+static void autotune_end_transaction(chip_state_t *chip) {
+  autotune_t *tune = &chip->autotune;
+  autotune_end_window(chip);
+  autotune_average(&tune->avg_cs_bytes, tune->cs_bytes);
+  autotune_average(&tune->avg_toggles, tune->cs_toggles);
+  tune->cs_bytes = 0;
+  tune->cs_toggles = 0;
+
+  uint64_t now = get_sim_nanos();
+  if (now - tune->last_decision_ns < AUTOTUNE_PERIOD_NS) return;
+  tune->last_decision_ns = now;
+
+  uint8_t current = (uint8_t)(chip->profile - pipeline_profiles);
+  uint8_t target = autotune_choose(chip, current);
+  if (target == current) {
+    tune->votes = 0;
+    return;
+  }
+  if (target != tune->candidate) {
+    tune->candidate = target;
+    tune->votes = 0;
+  }
+  if (++tune->votes < AUTOTUNE_VOTES) return;
+
+  tune->votes = 0;
+  CHIP_STAT_ADD(chip, profile_switches, 1);
+#if CHIP_FEATURE_STATS
+  printf("st7789 autotune: %s -> %s (window %u px, %u bytes and %u DC toggles per transaction)\n",
+         chip->profile->name, pipeline_profiles[target].name,
+         tune->avg_window >> 4, tune->avg_cs_bytes >> 4, tune->avg_toggles >> 4);
+#endif
+  chip_apply_profile(chip, &pipeline_profiles[target]);
+}
+
+static void chip_restart_fingerprint(chip_state_t *chip) {
+  chip->init_length = 0;
+  chip->fingerprinted = false;
+}
+#endif
+
+#if CHIP_FEATURE_BOOT_REPORT
+/* Datasheet minimum before the next command; UINT64_MAX if none is required */
+static uint64_t boot_minimum_ns(uint8_t command_code) {
+  switch (command_code) {
+    case CMD_SWRESET: return 5000000ull;
+    case CMD_SLPOUT:  return 120000000ull;
+    default:          return UINT64_MAX;
+  }
+}
+
+static const char *boot_command_name(uint8_t command_code) {
+  switch (command_code) {
+    case CMD_SWRESET: return "SWRESET";
+    default:          return "SLPOUT";
+  }
+}
+
+static void boot_print_report(chip_state_t *chip, uint64_t now) {
+  boot_report_t *boot = &chip->boot;
+  uint64_t saving = 0;
+  for (uint32_t i = 0; i < boot->count; i++) {
+    const boot_wait_t *wait = &boot->waits[i];
+    uint64_t minimum = boot_minimum_ns(wait->command);
+    if (wait->waited_ns < minimum) {
+      printf("st7789 boot: command 0x%02x came %.1f ms after %s, before the %.1f ms minimum; "
+             "real hardware would ignore it\n", wait->next, wait->waited_ns / 1e6,
+             boot_command_name(wait->command), minimum / 1e6);
+      continue;
+    }
+    saving += wait->waited_ns - minimum;
+    printf("st7789 boot: waited %.1f ms after %s, minimum %.1f ms, %.1f ms could be cut\n",
+           wait->waited_ns / 1e6, boot_command_name(wait->command), minimum / 1e6,
+           (wait->waited_ns - minimum) / 1e6);
+  }
+  printf("st7789 boot: first RAMWR %.1f ms after reset, init delays could be %.1f ms shorter\n",
+         (now - boot->start_ns) / 1e6, saving / 1e6);
+}
+
+/* Measure the gaps after settle-delay commands until the first RAMWR */
+static void boot_record_command(chip_state_t *chip, uint8_t command_code) {
+  boot_report_t *boot = &chip->boot;
+  if (!boot->enabled || boot->done) return;
+  uint64_t now = get_sim_nanos();
+  if (boot->waiting && boot->count < BOOT_WAITS) {
+    boot_wait_t *wait = &boot->waits[boot->count++];
+    wait->command = boot->pending;
+    wait->next = command_code;
+    wait->waited_ns = now - boot->pending_ns;
+  }
+  boot->waiting = boot_minimum_ns(command_code) != UINT64_MAX;
+  boot->pending = command_code;
+  boot->pending_ns = now;
+  if (command_code == CMD_RAMWR) {
+    boot->done = true;
+    boot_print_report(chip, now);
+  }
+}
+
+static void boot_restart(chip_state_t *chip) {
+  boot_report_t *boot = &chip->boot;
+  boot->done = false;
+  boot->waiting = false;
+  boot->count = 0;
+  boot->start_ns = get_sim_nanos();
+}
+#endif
+
 void chip_init(void) {
   chip_state_t *chip = calloc(1, sizeof(chip_state_t));
 
@@ -120,21 +873,164 @@ void chip_init(void) {
   const spi_config_t spi_config = {
     .sck = pin_init("SCL", INPUT),
     .mosi = pin_init("SDA", INPUT),
-    .miso = NO_PIN,
+    .miso = pin_init("SDO", INPUT),
     .done = chip_spi_done,
     .user_data = chip,
   };
   chip->spi = spi_init(&spi_config);
 
   // Initialize framebuffer (returns pointer inside buffer and fills width/height)
-  chip->framebuffer = framebuffer_init(&chip->width, &chip->height);
+  chip->framebuffer = framebuffer_init(&chip->fb_width, &chip->fb_height);
+
+  chip->controller = &controllers[0];
+  string_t controller_attr = attr_string_init("controller");
+  char controller_name[16] = { 0 };
+  if (controller_attr != STRING_NULL &&
+      string_read(controller_attr, controller_name, sizeof(controller_name) - 1) > 0) {
+    uint32_t i = 0;
+    while (i < sizeof(controllers) / sizeof(controllers[0]) && strcmp(controllers[i].name, controller_name)) i++;
+    if (i < sizeof(controllers) / sizeof(controllers[0])) {
+      chip->controller = &controllers[i];
+    } else {
+      printf("Warning: unknown controller %s, using %s\n", controller_name, chip->controller->name);
+    }
+  }
+  chip->pixel_bytes = 2;
+
+  // Panel size defaults to the host framebuffer size
+  chip->width = attr_read(attr_init("panelWidth", 0));
+  chip->height = attr_read(attr_init("panelHeight", 0));
+  if (!chip->width) chip->width = chip->fb_width ? chip->fb_width : chip->controller->gram_width;
+  if (!chip->height) chip->height = chip->fb_height ? chip->fb_height : chip->controller->gram_height;
+  if (chip->width > chip->controller->gram_width || chip->height > chip->controller->gram_height) {
+    printf("Warning: %ux%u panel is larger than the %ux%u GRAM of the %s\n", chip->width, chip->height,
+           chip->controller->gram_width, chip->controller->gram_height, chip->controller->name);
+  }
+  chip_setup_mapping(chip);
+
+#if CHIP_FEATURE_GRAM
+  chip->dirty_x0 = UINT32_MAX;
+  chip->tiles_x = (chip->width + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+  chip->tiles_y = (chip->height + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+  chip->tile_crc = malloc(chip->tiles_x * chip->tiles_y * sizeof(uint32_t));
+  chip->tile_valid = calloc(chip->tiles_x * chip->tiles_y, 1);
+  uint32_t gram_budget_kb = attr_read(attr_init("gramBudgetKB", 0));
+  if (!gram_budget_kb || !tile_cache_init(chip, gram_budget_kb * 1024)) {
+    chip->gram = malloc(chip->width * chip->height * sizeof(uint32_t));
+    for (uint32_t i = 0; i < chip->width * chip->height; ++i) {
+      chip->gram[i] = 0xff000000u;
+    }
+  }
+
+  const timer_config_t present_timer_config = {
+    .callback = chip_present_timer,
+    .user_data = chip,
+  };
+  chip->present_timer = timer_init(&present_timer_config);
+  chip->tear_free = attr_read(attr_init("tearFree", 0)) != 0;
+  if (chip->tear_free && chip->tile_cache) {
+    printf("Warning: tearFree is not available with gramBudgetKB\n");
+    chip->tear_free = false;
+  }
+  if (chip->tear_free && (chip->scale != 1 || chip->width != chip->fb_width)) {
+    chip->staging = malloc(chip->fb_width * chip->fb_height * sizeof(uint32_t));
+    for (uint32_t i = 0; i < chip->fb_width * chip->fb_height; ++i) {
+      chip->staging[i] = 0xff000000u;
+    }
+  }
+  chip_apply_profile(chip, &pipeline_profiles[PROFILE_DEFAULT]);
+#else
+  chip->spi_chunk = sizeof(chip->spi_buffer);
+#endif
+
+#if CHIP_FEATURE_THUMBNAIL
+  uint32_t thumbnail_scale = attr_read(attr_init("thumbnailScale", 0));
+  uint32_t thumbnail_interval_ms = attr_read(attr_init("thumbnailIntervalMs", 1000));
+  if (thumbnail_scale && thumbnail_scale != 4 && thumbnail_scale != 8) {
+    printf("Warning: thumbnailScale must be 4 or 8\n");
+  } else if (thumbnail_scale && thumbnail_interval_ms) {
+    chip->thumbnail_shift = thumbnail_scale == 4 ? 2 : 3;
+    chip->thumbnail_width = (chip->width + thumbnail_scale - 1) >> chip->thumbnail_shift;
+    chip->thumbnail_height = (chip->height + thumbnail_scale - 1) >> chip->thumbnail_shift;
+    chip->thumbnail = calloc(chip->thumbnail_width * chip->thumbnail_height, 4);
+    thumbnail_update(chip, 0, 0, chip->width - 1, chip->height - 1);
+    const timer_config_t thumbnail_timer_config = {
+      .callback = thumbnail_timer,
+      .user_data = chip,
+    };
+    chip->thumbnail_timer = timer_init(&thumbnail_timer_config);
+    timer_start(chip->thumbnail_timer, thumbnail_interval_ms * 1000, true);
+  }
+#endif
+
+#if CHIP_FEATURE_STATS
+  const timer_config_t stats_timer_config = {
+    .callback = chip_stats_timer,
+    .user_data = chip,
+  };
+  chip->stats_timer = timer_init(&stats_timer_config);
+  uint32_t stats_interval_ms = attr_read(attr_init("statsIntervalMs", 1000));
+  if (stats_interval_ms) {
+    timer_start(chip->stats_timer, stats_interval_ms * 1000, true);
+  }
+#endif
+
+#if CHIP_FEATURE_TRACE
+  chip->trace = attr_read(attr_init("trace", 0)) != 0;
+#endif
+
+#if CHIP_FEATURE_TIMELINE
+  if (attr_read(attr_init("timeline", 0))) {
+    chip->timeline = calloc(1, sizeof(timeline_t));
+  }
+#endif
+
+#if CHIP_FEATURE_BOOT_REPORT
+  chip->boot.enabled = attr_read(attr_init("bootReport", 1)) != 0;
+#endif
+
+#if CHIP_FEATURE_FRAME_LOG
+  if (attr_read(attr_init("frameLog", 0))) {
+    chip->frame_log = calloc(1, sizeof(frame_log_t));
+  }
+#endif
+
+  chip->vendor_commands = attr_read(attr_init("vendorCommands", 0)) != 0;
+#if CHIP_FEATURE_PROFILES
+  chip->autotune_enabled = attr_read(attr_init("autoTune", 1)) != 0;
+#endif
+  if (chip->vendor_commands) {
+    string_t symbol_attr = attr_string_init("memwrSymbol");
+    char symbol[64] = { 0 };
+    if (symbol_attr != STRING_NULL && string_read(symbol_attr, symbol, sizeof(symbol) - 1) > 0) {
+      chip->memwr_symbol = (uint32_t)(uintptr_t)_symbol_resolve(symbol);
+      printf("st7789: MEMWR symbol %s at 0x%08x\n", symbol, chip->memwr_symbol);
+    }
+  }
 
   // default mode = command
   chip->mode = MODE_COMMAND;
 
   chip_reset(chip);
+  bool clear = chip->width != chip->fb_width || chip->height != chip->fb_height;  // borders around a centered panel
+#if CHIP_FEATURE_GRAM
+  // Evicted tiles may be read back from the host, which must hold the same opaque black as GRAM
+  clear = clear || chip->tile_cache;
+#endif
+  if (clear) {
+    chip_clear_framebuffer(chip);
+  }
   
-  printf("st7789 Driver Chip initialized! display %ux%u\n", chip->width, chip->height);
+  printf("st7789 Driver Chip initialized! %s display %ux%u (%s)\n", chip->controller->name,
+         chip->width, chip->height, CHIP_VARIANT_NAME);
+
+#if CHIP_FEATURE_BENCH
+  // Optional self-benchmark: replay synthetic traffic through the SPI pipeline
+  uint32_t bench_iterations = attr_read(attr_init("selfBenchmark", 0));
+  if (bench_iterations) {
+    chip_self_benchmark(chip, bench_iterations, attr_read(attr_init("benchSpiMHz", 40)));
+  }
+#endif
 }
 
 /* Convert 16-bit RGB565 to 32-bit RGBA (0xAARRGGBB) */
@@ -149,6 +1045,695 @@ static inline uint32_t rgb565_to_rgba(uint16_t value) {
   return 0xff000000u | (r8 << 16) | (g8 << 8) | b8;
 }
 
+/* Write count visible pixels of panel row y, starting at column x0, to the host */
+static void chip_write_host_row(chip_state_t *chip, uint32_t y, uint32_t x0, const uint32_t *src, uint32_t count) {
+  uint32_t scale = chip->scale;
+  uint32_t dest = (uint32_t)(chip->row_base[y] + (int32_t)(x0 * scale));
+  if (scale == 1) {
+    buffer_write(chip->framebuffer, dest * sizeof(uint32_t), (void*)src, count * sizeof(uint32_t));
+    CHIP_STAT_ADD(chip, host_writes, 1);
+    return;
+  }
+  uint32_t *row = chip->host_row;
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint32_t k = 0; k < scale; k++) *row++ = src[i];
+  }
+  for (uint32_t k = 0; k < scale; k++, dest += chip->fb_width) {
+    buffer_write(chip->framebuffer, dest * sizeof(uint32_t), chip->host_row, count * scale * sizeof(uint32_t));
+  }
+  CHIP_STAT_ADD(chip, host_writes, scale);
+}
+
+#if CHIP_FEATURE_GRAM
+#if CHIP_FEATURE_SIMD
+typedef uint32_t u32x4_t __attribute__((vector_size(16)));
+#endif
+
+/* Convert a run of big-endian RGB565 pixels into consecutive RGBA words */
+static void rgb565_span_to_rgba(const uint8_t *src, uint32_t *dst, uint32_t count) {
+#if CHIP_FEATURE_SIMD
+  for (; count >= 4; count -= 4, src += 8, dst += 4) {
+    u32x4_t v = {
+      (uint32_t)src[0] << 8 | src[1], (uint32_t)src[2] << 8 | src[3],
+      (uint32_t)src[4] << 8 | src[5], (uint32_t)src[6] << 8 | src[7],
+    };
+    u32x4_t r5 = (v >> 11) & 0x1f;
+    u32x4_t g6 = (v >> 5) & 0x3f;
+    u32x4_t b5 = v & 0x1f;
+    u32x4_t rgba = 0xff000000u
+                 | ((r5 << 3) | (r5 >> 2)) << 16
+                 | ((g6 << 2) | (g6 >> 4)) << 8
+                 | ((b5 << 3) | (b5 >> 2));
+    memcpy(dst, &rgba, sizeof(rgba));
+  }
+#endif
+  for (; count; count--, src += 2) {
+    *dst++ = rgb565_to_rgba((uint16_t)src[0] << 8 | src[1]);
+  }
+}
+
+/*
+ * Tile cache (low-memory mode)
+ *
+ * GRAM is split into TILE_PIXELS tiles and only a fixed number of them is kept
+ * uncompressed. An evicted tile is first written to the host if it changed
+ * since the last present, then kept as a single color, as runs while the
+ * compressed budget allows, or else only in the host framebuffer, from where
+ * it is read back on the next miss. This needs the whole panel to be visible.
+ */
+static void tile_cache_bounds(chip_state_t *chip, uint32_t index, uint32_t *x0, uint32_t *y0, uint32_t *w, uint32_t *h) {
+  *x0 = (index % chip->tiles_x) << TILE_SHIFT;
+  *y0 = (index / chip->tiles_x) << TILE_SHIFT;
+  *w = chip->width - *x0 < (1u << TILE_SHIFT) ? chip->width - *x0 : 1u << TILE_SHIFT;
+  *h = chip->height - *y0 < (1u << TILE_SHIFT) ? chip->height - *y0 : 1u << TILE_SHIFT;
+}
+
+static void tile_cache_read_host(chip_state_t *chip, uint32_t index, uint32_t *dst) {
+  uint32_t x0, y0, w, h;
+  tile_cache_bounds(chip, index, &x0, &y0, &w, &h);
+  CHIP_STAT_ADD(chip, tile_host_reads, 1);
+  for (uint32_t i = 0; i < TILE_PIXELS; i++) dst[i] = 0xff000000u;
+  for (uint32_t r = 0; r < h; r++) {
+    uint32_t host = (uint32_t)chip->row_base[y0 + r] + x0 * chip->scale;
+    buffer_read(chip->framebuffer, host * sizeof(uint32_t), chip->host_row, w * chip->scale * sizeof(uint32_t));
+    for (uint32_t i = 0; i < w; i++) dst[(r << TILE_SHIFT) + i] = chip->host_row[i * chip->scale];
+  }
+}
+
+static void tile_cache_evict(chip_state_t *chip, uint32_t slot) {
+  tile_cache_t *cache = chip->tile_cache;
+  uint32_t index = cache->slot_tile[slot];
+  gram_tile_t *tile = &cache->tiles[index];
+  const uint32_t *src = &cache->pixels[slot * TILE_PIXELS];
+  if (tile->pending) {
+    uint32_t x0, y0, w, h;
+    tile_cache_bounds(chip, index, &x0, &y0, &w, &h);
+    for (uint32_t r = 0; r < h; r++) chip_write_host_row(chip, y0 + r, x0, &src[r << TILE_SHIFT], w);
+    tile->pending = false;
+    CHIP_STAT_ADD(chip, tile_early_writes, 1);
+  }
+
+  uint32_t runs = 1;
+  for (uint32_t i = 1; i < TILE_PIXELS; i++) runs += src[i] != src[i - 1];
+  tile->slot = TILE_NO_SLOT;
+  if (runs == 1) {
+    tile->store = TILE_SOLID;
+    tile->color = src[0];
+  } else if (runs <= TILE_PIXELS / 4 &&
+             cache->compressed_bytes + runs * sizeof(uint32_t) <= cache->compressed_budget) {
+    tile->store = TILE_RLE;
+    tile->runs = malloc(runs * sizeof(uint32_t));
+    tile->run_count = (uint16_t)runs;
+    cache->compressed_bytes += runs * sizeof(uint32_t);
+    uint32_t *run = tile->runs;
+    uint32_t start = 0;
+    for (uint32_t i = 1; i <= TILE_PIXELS; i++) {
+      if (i == TILE_PIXELS || src[i] != src[start]) {
+        // GRAM pixels are always opaque, so the alpha byte holds the length
+        *run++ = (i - start - 1) << 24 | (src[start] & 0xffffff);
+        start = i;
+      }
+    }
+  } else {
+    tile->store = TILE_HOST;
+  }
+}
+
+static uint32_t *tile_cache_load(chip_state_t *chip, uint32_t index) {
+  tile_cache_t *cache = chip->tile_cache;
+  uint32_t slot;
+  if (cache->slots_used < cache->slots) {
+    slot = cache->slots_used++;
+  } else {
+    // Clock: slots used since the hand last passed get a second chance
+    while (cache->referenced[cache->hand]) {
+      cache->referenced[cache->hand] = 0;
+      cache->hand = (cache->hand + 1) % cache->slots;
+    }
+    slot = cache->hand;
+    cache->hand = (cache->hand + 1) % cache->slots;
+    tile_cache_evict(chip, slot);
+  }
+  CHIP_STAT_ADD(chip, tile_misses, 1);
+
+  gram_tile_t *tile = &cache->tiles[index];
+  uint32_t *dst = &cache->pixels[slot * TILE_PIXELS];
+  if (tile->store == TILE_SOLID) {
+    for (uint32_t i = 0; i < TILE_PIXELS; i++) dst[i] = tile->color;
+  } else if (tile->store == TILE_RLE) {
+    uint32_t *out = dst;
+    for (uint32_t r = 0; r < tile->run_count; r++) {
+      uint32_t color = 0xff000000u | tile->runs[r];
+      for (uint32_t n = (tile->runs[r] >> 24) + 1; n; n--) *out++ = color;
+    }
+    free(tile->runs);
+    tile->runs = NULL;
+    cache->compressed_bytes -= tile->run_count * sizeof(uint32_t);
+  } else {
+    tile_cache_read_host(chip, index, dst);
+  }
+  tile->slot = (uint16_t)slot;
+  cache->slot_tile[slot] = (uint16_t)index;
+  cache->referenced[slot] = 1;
+  return dst;
+}
+
+/* Drop all tiles and start from a black panel */
+static void tile_cache_clear(chip_state_t *chip) {
+  tile_cache_t *cache = chip->tile_cache;
+  for (uint32_t i = 0; i < chip->tiles_x * chip->tiles_y; i++) {
+    free(cache->tiles[i].runs);
+    cache->tiles[i] = (gram_tile_t){ .color = 0xff000000u, .slot = TILE_NO_SLOT, .store = TILE_SOLID };
+  }
+  cache->slots_used = 0;
+  cache->hand = 0;
+  cache->compressed_bytes = 0;
+}
+
+/* Set up low-memory mode within budget bytes; false if the mapping does not allow it */
+static bool tile_cache_init(chip_state_t *chip, uint32_t budget) {
+  if (chip->visible_x0 || chip->visible_y0 ||
+      chip->visible_x1 != chip->width - 1 || chip->visible_y1 != chip->height - 1) {
+    printf("Warning: gramBudgetKB needs the whole panel on the framebuffer, using a full GRAM\n");
+    return false;
+  }
+  uint32_t tile_count = chip->tiles_x * chip->tiles_y;
+  uint32_t fixed = sizeof(tile_cache_t) + tile_count * sizeof(gram_tile_t) + chip->width * sizeof(uint32_t);
+  uint32_t slot_size = TILE_PIXELS * sizeof(uint32_t) + sizeof(uint16_t) + 1;
+  // Half of what is left holds uncompressed tiles, the other half compressed ones
+  uint32_t slots = budget > fixed ? (budget - fixed) / 2 / slot_size : 0;
+  if (slots < 4) slots = 4;
+  if (slots > tile_count) slots = tile_count;
+  if (slots > TILE_NO_SLOT) slots = TILE_NO_SLOT;
+
+  tile_cache_t *cache = calloc(1, sizeof(tile_cache_t));
+  cache->tiles = calloc(tile_count, sizeof(gram_tile_t));
+  cache->pixels = malloc(slots * TILE_PIXELS * sizeof(uint32_t));
+  cache->slot_tile = malloc(slots * sizeof(uint16_t));
+  cache->referenced = calloc(slots, 1);
+  cache->row = malloc(chip->width * sizeof(uint32_t));
+  cache->slots = slots;
+  cache->compressed_budget = budget > fixed + slots * slot_size ? budget - fixed - slots * slot_size : 0;
+  chip->tile_cache = cache;
+  tile_cache_clear(chip);
+  printf("st7789: GRAM tile cache, %u of %u tiles uncompressed, %u bytes for compressed tiles\n",
+         slots, tile_count, cache->compressed_budget);
+  return true;
+}
+
+/*
+ * Pointer to GRAM pixel (x, y). The pixels after it are contiguous up to the
+ * end of the row, or with the tile cache up to the end of the tile row.
+ */
+static inline uint32_t *gram_pixel(chip_state_t *chip, uint32_t x, uint32_t y) {
+  tile_cache_t *cache = chip->tile_cache;
+  if (!cache) return &chip->gram[y * chip->width + x];
+  uint32_t index = (y >> TILE_SHIFT) * chip->tiles_x + (x >> TILE_SHIFT);
+  uint32_t slot = cache->tiles[index].slot;
+  uint32_t *pixels;
+  if (slot != TILE_NO_SLOT) {
+    CHIP_STAT_ADD(chip, tile_hits, 1);
+    cache->referenced[slot] = 1;
+    pixels = &cache->pixels[slot * TILE_PIXELS];
+  } else {
+    pixels = tile_cache_load(chip, index);
+  }
+  return pixels + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+}
+
+/* Present the changed tiles of an area, joining neighbouring ones into row spans */
+static void tile_cache_write_back(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  tile_cache_t *cache = chip->tile_cache;
+  for (uint32_t y = y0; y <= y1; y++) {
+    const gram_tile_t *tiles = &cache->tiles[(y >> TILE_SHIFT) * chip->tiles_x];
+    uint32_t start = x0, n = 0;
+    for (uint32_t x = x0; x <= x1; ) {
+      uint32_t end = ((x >> TILE_SHIFT) + 1) << TILE_SHIFT;
+      if (end > x1 + 1) end = x1 + 1;
+      const gram_tile_t *tile = &tiles[x >> TILE_SHIFT];
+      if (tile->pending) {
+        if (!n) start = x;
+        memcpy(&cache->row[n], &cache->pixels[tile->slot * TILE_PIXELS + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK)],
+               (end - x) * sizeof(uint32_t));
+        n += end - x;
+      } else if (n) {
+        chip_write_host_row(chip, y, start, cache->row, n);
+        n = 0;
+      }
+      x = end;
+    }
+    if (n) chip_write_host_row(chip, y, start, cache->row, n);
+  }
+  for (uint32_t ty = y0 >> TILE_SHIFT; ty <= y1 >> TILE_SHIFT; ty++) {
+    for (uint32_t tx = x0 >> TILE_SHIFT; tx <= x1 >> TILE_SHIFT; tx++) {
+      cache->tiles[ty * chip->tiles_x + tx].pending = false;
+    }
+  }
+}
+
+static inline void gram_mark_dirty(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  for (uint32_t ty = y0 >> TILE_SHIFT; ty <= y1 >> TILE_SHIFT; ty++) {
+    memset(&chip->tile_valid[ty * chip->tiles_x + (x0 >> TILE_SHIFT)], 0, (x1 >> TILE_SHIFT) - (x0 >> TILE_SHIFT) + 1);
+    if (chip->tile_cache) {
+      for (uint32_t tx = x0 >> TILE_SHIFT; tx <= x1 >> TILE_SHIFT; tx++) {
+        chip->tile_cache->tiles[ty * chip->tiles_x + tx].pending = true;
+      }
+    }
+  }
+  if (chip->dirty_x0 == UINT32_MAX) {
+    chip->dirty_x0 = x0;
+    chip->dirty_y0 = y0;
+    chip->dirty_x1 = x1;
+    chip->dirty_y1 = y1;
+    return;
+  }
+  if (x0 < chip->dirty_x0) chip->dirty_x0 = x0;
+  if (y0 < chip->dirty_y0) chip->dirty_y0 = y0;
+  if (x1 > chip->dirty_x1) chip->dirty_x1 = x1;
+  if (y1 > chip->dirty_y1) chip->dirty_y1 = y1;
+}
+
+/*
+ * Publish whole panel rows y0..y1 with a single host write, so the host never
+ * shows (or screenshots) a partly presented frame.
+ */
+static void chip_present_rows(chip_state_t *chip, uint32_t y0, uint32_t y1) {
+  uint32_t rows = y1 - y0 + 1;
+  if (chip->scale == 1 && chip->width == chip->fb_width) {
+    buffer_write(chip->framebuffer, (uint32_t)chip->row_base[y0] * sizeof(uint32_t),
+                 &chip->gram[y0 * chip->width], chip->width * rows * sizeof(uint32_t));
+    CHIP_STAT_ADD(chip, host_writes, 1);
+    return;
+  }
+
+  uint32_t scale = chip->scale;
+  uint32_t span = chip->visible_x1 - chip->visible_x0 + 1;
+  uint32_t host_x = (uint32_t)((int32_t)(chip->visible_x0 * scale) + chip->offset_x);
+  uint32_t host_y = (uint32_t)((int32_t)(y0 * scale) + chip->offset_y);
+  uint32_t *dst = chip->staging;
+  for (uint32_t y = y0; y <= y1; y++) {
+    const uint32_t *src = &chip->gram[y * chip->width + chip->visible_x0];
+    uint32_t *row = dst + host_x;
+    for (uint32_t i = 0; i < span; i++) {
+      for (uint32_t k = 0; k < scale; k++) *row++ = src[i];
+    }
+    for (uint32_t k = 1; k < scale; k++) {
+      memcpy(dst + k * chip->fb_width + host_x, dst + host_x, span * scale * sizeof(uint32_t));
+    }
+    dst += scale * chip->fb_width;
+  }
+  buffer_write(chip->framebuffer, host_y * chip->fb_width * sizeof(uint32_t), chip->staging,
+               rows * scale * chip->fb_width * sizeof(uint32_t));
+  CHIP_STAT_ADD(chip, host_writes, 1);
+}
+
+/* Copy panel area x0..x1, y0..y1 (visible) from GRAM to the host framebuffer */
+static void chip_write_back(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  if (chip->tear_free) {
+    chip_present_rows(chip, y0, y1);
+    return;
+  }
+  if (chip->tile_cache) {
+    tile_cache_write_back(chip, x0, y0, x1, y1);
+    return;
+  }
+
+  uint32_t span = x1 - x0 + 1;
+  uint32_t offset = y0 * chip->width + x0;
+  if (chip->scale == 1 && span == chip->width && chip->width == chip->fb_width) {
+    // Full-width 1:1 rows are contiguous, send them in one go
+    buffer_write(chip->framebuffer, (uint32_t)chip->row_base[y0] * sizeof(uint32_t), &chip->gram[offset],
+                 span * (y1 - y0 + 1) * sizeof(uint32_t));
+    CHIP_STAT_ADD(chip, host_writes, 1);
+    return;
+  }
+  for (uint32_t y = y0; y <= y1; y++, offset += chip->width) {
+    chip_write_host_row(chip, y, x0, &chip->gram[offset], span);
+  }
+}
+
+/* Write the dirty part of GRAM back to the host framebuffer */
+static void chip_present(chip_state_t *chip) {
+  if (chip->dirty_x0 == UINT32_MAX) return;
+#if CHIP_FEATURE_THUMBNAIL
+  if (chip->thumbnail) {
+    thumbnail_update(chip, chip->dirty_x0, chip->dirty_y0, chip->dirty_x1, chip->dirty_y1);
+  }
+#endif
+  uint32_t x0 = chip->dirty_x0 > chip->visible_x0 ? chip->dirty_x0 : chip->visible_x0;
+  uint32_t x1 = chip->dirty_x1 < chip->visible_x1 ? chip->dirty_x1 : chip->visible_x1;
+  uint32_t y0 = chip->dirty_y0 > chip->visible_y0 ? chip->dirty_y0 : chip->visible_y0;
+  uint32_t y1 = chip->dirty_y1 < chip->visible_y1 ? chip->dirty_y1 : chip->visible_y1;
+  chip->dirty_x0 = UINT32_MAX;
+  if (x0 > x1 || y0 > y1) return;
+  CHIP_STAT_ADD(chip, presents, 1);
+  chip->perf.presents++;
+#if CHIP_FEATURE_TIMELINE
+  uint64_t host_writes = chip->stats.host_writes;
+#endif
+  chip_write_back(chip, x0, y0, x1, y1);
+  CHIP_TIMELINE(chip, timeline_add(chip, TIMELINE_PRESENT, get_sim_nanos(), 0,
+                                   (uint32_t)(chip->stats.host_writes - host_writes), 0));
+}
+#endif
+
+#if CHIP_FEATURE_GRAM
+/* Standard (zlib) CRC32, without the final inversion */
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t length) {
+  static uint32_t table[256];
+  if (!table[1]) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  while (length--) crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+/* CRC32 of the big-endian RGB565 pixels of a GRAM area inside one tile, row-major */
+static uint32_t gram_area_crc(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  uint32_t crc = 0xffffffffu;
+  uint8_t row[2 << TILE_SHIFT];
+  for (uint32_t y = y0; y <= y1; y++) {
+    const uint32_t *src = gram_pixel(chip, x0, y);
+    for (uint32_t x = x0; x <= x1; ) {
+      uint32_t n = 0;
+      for (; x <= x1 && n < sizeof(row); x++, n += 2) {
+        uint32_t c = src[x - x0];
+        uint16_t v = (uint16_t)(((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f));
+        row[n] = v >> 8;
+        row[n + 1] = v & 0xff;
+      }
+      crc = crc32_update(crc, row, n);
+    }
+  }
+  return ~crc;
+}
+
+/*
+ * Window CRC for CRCRD: the CRC32 of the big-endian CRC32s of each tile's part
+ * of the window, tiles in row-major order. Tiles entirely inside the window
+ * reuse their cached CRC, so only tiles written since the last read and the
+ * window edges are rescanned.
+ */
+static uint32_t gram_window_crc(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  const uint32_t tile = 1 << TILE_SHIFT;
+  uint32_t crc = 0xffffffffu;
+  for (uint32_t ty = y0 >> TILE_SHIFT; ty <= y1 >> TILE_SHIFT; ty++) {
+    uint32_t tile_y0 = ty * tile;
+    uint32_t tile_y1 = tile_y0 + tile - 1 < chip->height ? tile_y0 + tile - 1 : chip->height - 1;
+    uint32_t part_y0 = y0 > tile_y0 ? y0 : tile_y0;
+    uint32_t part_y1 = y1 < tile_y1 ? y1 : tile_y1;
+    for (uint32_t tx = x0 >> TILE_SHIFT; tx <= x1 >> TILE_SHIFT; tx++) {
+      uint32_t tile_x0 = tx * tile;
+      uint32_t tile_x1 = tile_x0 + tile - 1 < chip->width ? tile_x0 + tile - 1 : chip->width - 1;
+      uint32_t part_x0 = x0 > tile_x0 ? x0 : tile_x0;
+      uint32_t part_x1 = x1 < tile_x1 ? x1 : tile_x1;
+      uint32_t tile_crc;
+      if (part_x0 == tile_x0 && part_x1 == tile_x1 && part_y0 == tile_y0 && part_y1 == tile_y1) {
+        uint32_t index = ty * chip->tiles_x + tx;
+        if (!chip->tile_valid[index]) {
+          chip->tile_crc[index] = gram_area_crc(chip, tile_x0, tile_y0, tile_x1, tile_y1);
+          chip->tile_valid[index] = 1;
+        }
+        tile_crc = chip->tile_crc[index];
+      } else {
+        tile_crc = gram_area_crc(chip, part_x0, part_y0, part_x1, part_y1);
+      }
+      const uint8_t be[4] = { tile_crc >> 24, (tile_crc >> 16) & 0xff, (tile_crc >> 8) & 0xff, tile_crc & 0xff };
+      crc = crc32_update(crc, be, sizeof(be));
+    }
+  }
+  return ~crc;
+}
+#endif
+
+#if CHIP_FEATURE_THUMBNAIL
+/* Recompute the thumbnail pixels covering a GRAM area with a box filter */
+static void thumbnail_update(chip_state_t *chip, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+  uint32_t shift = chip->thumbnail_shift;
+  uint32_t block = 1 << shift;
+  for (uint32_t ty = y0 >> shift; ty <= y1 >> shift; ty++) {
+    uint32_t py0 = ty << shift;
+    uint32_t py1 = py0 + block < chip->height ? py0 + block : chip->height;
+    for (uint32_t tx = x0 >> shift; tx <= x1 >> shift; tx++) {
+      uint32_t px0 = tx << shift;
+      uint32_t px1 = px0 + block < chip->width ? px0 + block : chip->width;
+      uint32_t count = (px1 - px0) * (py1 - py0);
+      uint8_t *out = &chip->thumbnail[(ty * chip->thumbnail_width + tx) * 4];
+#if CHIP_FEATURE_SIMD
+      // lanes: blue, green, red, alpha
+      const u32x4_t lane_shift = { 0, 8, 16, 24 };
+      u32x4_t sum = { 0, 0, 0, 0 };
+      for (uint32_t y = py0; y < py1; y++) {
+        // Blocks never cross a tile, so the row is contiguous even with the tile cache
+        const uint32_t *src = gram_pixel(chip, px0, y);
+        for (uint32_t x = 0; x < px1 - px0; x++) {
+          u32x4_t c = { src[x], src[x], src[x], src[x] };
+          sum += (c >> lane_shift) & 0xff;
+        }
+      }
+      u32x4_t avg = count == (block << shift) ? sum >> (2 * shift) : sum / count;
+      out[0] = (uint8_t)avg[2];
+      out[1] = (uint8_t)avg[1];
+      out[2] = (uint8_t)avg[0];
+      out[3] = (uint8_t)avg[3];
+#else
+      uint32_t r = 0, g = 0, b = 0, a = 0;
+      for (uint32_t y = py0; y < py1; y++) {
+        const uint32_t *src = gram_pixel(chip, px0, y);
+        for (uint32_t x = 0; x < px1 - px0; x++) {
+          b += src[x] & 0xff;
+          g += (src[x] >> 8) & 0xff;
+          r += (src[x] >> 16) & 0xff;
+          a += src[x] >> 24;
+        }
+      }
+      out[0] = (uint8_t)(r / count);
+      out[1] = (uint8_t)(g / count);
+      out[2] = (uint8_t)(b / count);
+      out[3] = (uint8_t)(a / count);
+#endif
+    }
+  }
+  chip->thumbnail_changed = true;
+}
+
+/* Print the thumbnail as one base64 line, only when it changed */
+static void thumbnail_timer(void *user_data) {
+  chip_state_t *chip = (chip_state_t*)user_data;
+  if (!chip->thumbnail_changed) return;
+  chip->thumbnail_changed = false;
+
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const uint8_t *data = chip->thumbnail;
+  uint32_t length = chip->thumbnail_width * chip->thumbnail_height * 4;
+  char line[257];
+  uint32_t used = 0;
+  printf("st7789 thumbnail %ux%u rgba ", chip->thumbnail_width, chip->thumbnail_height);
+  for (uint32_t i = 0; i < length; i += 3) {
+    uint32_t v = (uint32_t)data[i] << 16;
+    if (i + 1 < length) v |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < length) v |= data[i + 2];
+    line[used++] = alphabet[(v >> 18) & 0x3f];
+    line[used++] = alphabet[(v >> 12) & 0x3f];
+    line[used++] = i + 1 < length ? alphabet[(v >> 6) & 0x3f] : '=';
+    line[used++] = i + 2 < length ? alphabet[v & 0x3f] : '=';
+    if (used == sizeof(line) - 1) {
+      line[used] = 0;
+      fputs(line, stdout);
+      used = 0;
+    }
+  }
+  line[used] = 0;
+  printf("%s\n", line);
+}
+#endif
+
+/* CRCRD: x0, y0, x1, y1 (16-bit big-endian, panel coordinates); answers the 32-bit CRC */
+static void execute_crcrd(chip_state_t *chip) {
+  const uint8_t *args = chip->command_buf;
+  uint32_t x0 = args[0] << 8 | args[1];
+  uint32_t y0 = args[2] << 8 | args[3];
+  uint32_t x1 = args[4] << 8 | args[5];
+  uint32_t y1 = args[6] << 8 | args[7];
+  if (x1 >= chip->width) x1 = chip->width - 1;
+  if (y1 >= chip->height) y1 = chip->height - 1;
+  uint32_t crc = 0;
+#if CHIP_FEATURE_GRAM
+  if (x0 <= x1 && y0 <= y1) {
+    crc = gram_window_crc(chip, x0, y0, x1, y1);
+  }
+#else
+  (void)x0;
+  (void)y0;
+  printf("Warning: CRCRD needs the chip's GRAM, not available in the %s build\n", CHIP_VARIANT_NAME);
+#endif
+  chip->response[0] = crc >> 24;
+  chip->response[1] = (crc >> 16) & 0xff;
+  chip->response[2] = (crc >> 8) & 0xff;
+  chip->response[3] = crc & 0xff;
+  chip->response_length = 4;
+}
+
+/*
+ * PERFRD: one flags byte. Answers the counters as big-endian 32-bit values:
+ * bytes, pixels, redundant pixels, windows, presents and CS-low time in us.
+ * With PERFRD_CLEAR the counters restart after the snapshot.
+ */
+static void execute_perfrd(chip_state_t *chip) {
+  perf_counters_t *perf = &chip->perf;
+  uint64_t now = get_sim_nanos();
+  uint64_t busy_ns = perf->busy_ns + (perf->selected ? now - perf->select_ns : 0);
+  const uint32_t values[] = {
+    perf->bytes, perf->pixels, perf->redundant_pixels, perf->windows, perf->presents, (uint32_t)(busy_ns / 1000),
+  };
+  for (uint32_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    chip->response[i * 4] = values[i] >> 24;
+    chip->response[i * 4 + 1] = (values[i] >> 16) & 0xff;
+    chip->response[i * 4 + 2] = (values[i] >> 8) & 0xff;
+    chip->response[i * 4 + 3] = values[i] & 0xff;
+  }
+  chip->response_length = sizeof(values);
+  if (chip->command_buf[0] & PERFRD_CLEAR) {
+    bool selected = perf->selected;
+    memset(perf, 0, sizeof(*perf));
+    perf->selected = selected;
+    perf->select_ns = now;
+  }
+}
+
+#if CHIP_FEATURE_GRAM
+/* Copy count GRAM pixels from (sx, sy) to (dx, dy); the two may overlap */
+static void gram_copy_row(chip_state_t *chip, uint32_t sx, uint32_t sy, uint32_t dx, uint32_t dy, uint32_t count) {
+  if (!chip->tile_cache) {
+    memmove(&chip->gram[dy * chip->width + dx], &chip->gram[sy * chip->width + sx], count * sizeof(uint32_t));
+    return;
+  }
+  // Tile rows are not contiguous, go through the scratch row
+  uint32_t *row = chip->tile_cache->row;
+  for (uint32_t i = 0; i < count; ) {
+    uint32_t n = (1u << TILE_SHIFT) - ((sx + i) & TILE_MASK);
+    if (n > count - i) n = count - i;
+    memcpy(&row[i], gram_pixel(chip, sx + i, sy), n * sizeof(uint32_t));
+    i += n;
+  }
+  for (uint32_t i = 0; i < count; ) {
+    uint32_t n = (1u << TILE_SHIFT) - ((dx + i) & TILE_MASK);
+    if (n > count - i) n = count - i;
+    memcpy(gram_pixel(chip, dx + i, dy), &row[i], n * sizeof(uint32_t));
+    // Mark right away: the next tile load may evict this one
+    gram_mark_dirty(chip, dx + i, dy, dx + i + n - 1, dy);
+    i += n;
+  }
+}
+#endif
+
+/*
+ * RECTCP: copy the GRAM rectangle x0, y0, x1, y1 to dx, dy (16-bit big-endian,
+ * unrotated panel coordinates). Overlapping rectangles copy as if through a
+ * temporary buffer; parts that fall outside the panel are skipped. Only the
+ * destination is marked dirty.
+ */
+static void execute_rectcp(chip_state_t *chip) {
+  const uint8_t *args = chip->command_buf;
+  uint32_t x0 = args[0] << 8 | args[1];
+  uint32_t y0 = args[2] << 8 | args[3];
+  uint32_t x1 = args[4] << 8 | args[5];
+  uint32_t y1 = args[6] << 8 | args[7];
+  uint32_t dx = args[8] << 8 | args[9];
+  uint32_t dy = args[10] << 8 | args[11];
+  if (x1 >= chip->width) x1 = chip->width - 1;
+  if (y1 >= chip->height) y1 = chip->height - 1;
+  if (x0 > x1 || y0 > y1 || dx >= chip->width || dy >= chip->height) return;
+  uint32_t w = x1 - x0 + 1;
+  uint32_t h = y1 - y0 + 1;
+  if (dx + w > chip->width) w = chip->width - dx;
+  if (dy + h > chip->height) h = chip->height - dy;
+#if CHIP_FEATURE_GRAM
+  for (uint32_t i = 0; i < h; i++) {
+    // Moving down, copy the bottom row first so no source row is overwritten before it is read
+    uint32_t r = dy > y0 ? h - 1 - i : i;
+    gram_copy_row(chip, x0, y0 + r, dx, dy + r, w);
+  }
+  // The tile cache marked each row while its tiles were loaded
+  if (!chip->tile_cache) gram_mark_dirty(chip, dx, dy, dx + w - 1, dy + h - 1);
+#else
+  printf("Warning: RECTCP needs the chip's GRAM, not available in the %s build\n", CHIP_VARIANT_NAME);
+#endif
+}
+
+/* Bytes from the write pointer to the end of the RAMWR window, 0 if the pointer is outside it */
+static uint32_t chip_window_bytes_left(chip_state_t *chip) {
+  if (chip->column_end < chip->column_start || chip->page_end < chip->page_start ||
+      chip->active_column < chip->column_start || chip->active_column > chip->column_end ||
+      chip->active_page < chip->page_start || chip->active_page > chip->page_end) {
+    return 0;
+  }
+  uint64_t pixels;
+  if (chip->scanning_direction & SCAN_MV) {
+    pixels = (uint64_t)(chip->column_end - chip->active_column) * (chip->page_end - chip->page_start + 1) +
+             (chip->page_end - chip->active_page + 1);
+  } else {
+    pixels = (uint64_t)(chip->page_end - chip->active_page) * (chip->column_end - chip->column_start + 1) +
+             (chip->column_end - chip->active_column + 1);
+  }
+  uint64_t bytes = pixels * chip->pixel_bytes - chip->pixel_carry_length;
+  return bytes > UINT32_MAX ? UINT32_MAX : (uint32_t)bytes;
+}
+
+/* Start the next SPI transfer */
+static void chip_spi_arm(chip_state_t *chip) {
+  uint32_t count = chip->spi_chunk;
+  chip->response_armed = false;
+  if (chip->response_length) {
+    // The buffer is shifted out on SDO while the firmware clocks in dummy bytes
+    memcpy(chip->spi_buffer, chip->response, chip->response_length);
+    count = chip->response_length;
+    chip->response_length = 0;
+    chip->response_armed = true;
+  } else if (chip->mode == MODE_DATA && chip->command_index < chip->command_size &&
+             command_has_response(chip->command_code)) {
+    // Stop right after the arguments so the response is loaded in time
+    count = chip->command_size - chip->command_index;
+  } else if (chip->mode == MODE_DATA && chip->ram_write) {
+    // End the transfer where the window ends, so a window never straddles two callbacks
+    uint32_t left = chip_window_bytes_left(chip);
+    if (left && left < count) count = left;
+  }
+  spi_start(chip->spi, chip->spi_buffer, count);
+}
+
+/* Clear the framebuffer to opaque black */
+static void chip_clear_framebuffer(chip_state_t *chip) {
+  if (!chip->framebuffer) return;
+#if CHIP_FEATURE_GRAM
+  if (chip->tile_cache) {
+    tile_cache_clear(chip);
+  } else {
+    for (uint32_t i = 0; i < chip->width * chip->height; ++i) {
+      chip->gram[i] = 0xff000000u;
+    }
+  }
+  chip->dirty_x0 = UINT32_MAX;
+  memset(chip->tile_valid, 0, chip->tiles_x * chip->tiles_y);
+#if CHIP_FEATURE_THUMBNAIL
+  if (chip->thumbnail) {
+    thumbnail_update(chip, 0, 0, chip->width - 1, chip->height - 1);
+  }
+#endif
+#endif
+  for (uint32_t i = 0; i < chip->fb_width; ++i) {
+    chip->host_row[i] = 0xff000000u;
+  }
+  for (uint32_t y = 0; y < chip->fb_height; ++y) {
+    buffer_write(chip->framebuffer, y * chip->fb_width * sizeof(uint32_t), chip->host_row,
+                 chip->fb_width * sizeof(uint32_t));
+  }
+}
+
 void chip_pin_change(void *user_data, pin_t pin, uint32_t value) {
   chip_state_t *chip = (chip_state_t*)user_data;
 
@@ -159,10 +1744,29 @@ void chip_pin_change(void *user_data, pin_t pin, uint32_t value) {
       chip->command_size = 0;
       chip->command_index = 0;
       chip->command_code = 0;
-      spi_start(chip->spi, chip->spi_buffer, sizeof(chip->spi_buffer));
+      CHIP_TIMELINE(chip, chip->timeline->cs_start = get_sim_nanos());
+      chip->perf.selected = true;
+      chip->perf.select_ns = get_sim_nanos();
+      chip_spi_arm(chip);
     } else {
       // Deselected: stop SPI and flush any pending
       spi_stop(chip->spi);
+      if (chip->perf.selected) chip->perf.busy_ns += get_sim_nanos() - chip->perf.select_ns;
+      chip->perf.selected = false;
+      CHIP_TIMELINE(chip, {
+        timeline_window_end(chip);
+        timeline_add(chip, TIMELINE_CS, chip->timeline->cs_start, get_sim_nanos() - chip->timeline->cs_start,
+                     chip->timeline->cs_bytes, 0);
+        chip->timeline->cs_bytes = 0;
+      });
+      CHIP_FRAME_LOG(chip, frame_log_boundary(chip));
+#if CHIP_FEATURE_GRAM
+      if (chip->present_policy == PRESENT_WINDOW) chip_present(chip);
+      if (chip->present_policy == PRESENT_FRAME) chip_present_frame(chip);
+#endif
+#if CHIP_FEATURE_PROFILES
+      if (chip->autotune_enabled && chip->fingerprinted) autotune_end_transaction(chip);
+#endif
     }
   }
 
@@ -173,9 +1777,12 @@ void chip_pin_change(void *user_data, pin_t pin, uint32_t value) {
     if (chip->mode != new_mode) {
       // Stop current SPI to process partial buffer
       spi_stop(chip->spi);
+#if CHIP_FEATURE_PROFILES
+      chip->autotune.cs_toggles++;
+#endif
       chip->mode = new_mode;
       if (pin_read(chip->cs_pin) == LOW) {
-        spi_start(chip->spi, chip->spi_buffer, sizeof(chip->spi_buffer));
+        chip_spi_arm(chip);
       }
     }
   }
@@ -183,62 +1790,163 @@ void chip_pin_change(void *user_data, pin_t pin, uint32_t value) {
   if (pin == chip->rst_pin && value == LOW) {
     // hardware reset
     spi_stop(chip->spi);
+    chip->pixel_bytes = 2;
     chip_reset(chip);
-    // clear framebuffer to black
-    if (chip->framebuffer) {
-      uint32_t clear = 0xff000000u; // opaque black
-      for (uint32_t i = 0; i < chip->width * chip->height; ++i) {
-        buffer_write(chip->framebuffer, i * sizeof(clear), &clear, sizeof(clear));
-      }
+    chip_clear_framebuffer(chip);
+#if CHIP_FEATURE_PROFILES
+    chip_restart_fingerprint(chip);
+#endif
+#if CHIP_FEATURE_BOOT_REPORT
+    boot_restart(chip);
+#endif
+  }
+}
+
+int command_args_size(chip_state_t *chip, uint8_t command_code) {
+  if (command_is_vendor(command_code) && chip->vendor_commands) {
+    switch (command_code) {
+      case CMD_CRCRD:  return 8;
+      case CMD_MEMWR:  return 13;
+      case CMD_PERFRD: return 1;
+      case CMD_RECTCP: return 12;
+      default:         return 0;
     }
   }
+  return chip->controller->commands[command_code] & ~CMD_KNOWN;
 }
 
-int command_args_size(uint8_t command_code) {
-  switch (command_code) {
-    case CMD_MADCTL:
-    case CMD_PWCTR2:
-    case CMD_INVCTR:
-    case CMD_VMCTR:
-    case CMD_COLMOD:  return 1;
-    case CMD_PWCTR3:
-    case CMD_PWCTR4:
-    case CMD_PWCTR5:
-    case CMD_DISSET5: return 2;
-    case CMD_FRMCTR1:
-    case CMD_FRMCTR2:
-    case CMD_PWCTR1:  return 3;
-    case CMD_CASET:
-    case CMD_RASET:   return 4;
-    case CMD_FRMCTR3: return 6;
-    case CMD_GMCTRP1:
-    case CMD_GMCTRN1: return 16;
-    default:          return 0;
+/* Apply a CASET (set_page false) or RASET (set_page true) address range */
+static void set_address_range(chip_state_t *chip, bool set_page, uint16_t start, uint16_t end) {
+  if ((chip->scanning_direction & SCAN_MV) ? !set_page : set_page) {
+    chip->active_page = start;
+    chip->page_start = start;
+    chip->page_end = end;
+    if (chip->scanning_direction & SCAN_MY) {
+      // Some displays use offsets; keep simple and clamp
+      uint32_t offset = chip->controller->mirror_row_offset;
+      if (chip->page_start >= offset) chip->page_start -= offset;
+      if (chip->page_end >= offset) chip->page_end -= offset;
+      if (chip->active_page >= offset) chip->active_page -= offset;
+    }
+  } else {
+    chip->active_column = start;
+    chip->column_start = start;
+    chip->column_end = end;
   }
 }
 
-void execute_command(chip_state_t *chip) {
+/*
+ * MEMWR: pull a window of pixels straight out of MCU memory.
+ * Arguments: x0, y0, x1, y1 (16-bit big-endian), 32-bit big-endian source
+ * address and a format byte (MEMWR_RGB565_BE or MEMWR_RGB565_LE). Address 0
+ * reads from the symbol named by the memwrSymbol attr.
+ */
+static void execute_memwr(chip_state_t *chip) {
+  const uint8_t *args = chip->command_buf;
+  uint16_t x0 = args[0] << 8 | args[1];
+  uint16_t y0 = args[2] << 8 | args[3];
+  uint16_t x1 = args[4] << 8 | args[5];
+  uint16_t y1 = args[6] << 8 | args[7];
+  uint32_t address = (uint32_t)args[8] << 24 | (uint32_t)args[9] << 16 | (uint32_t)args[10] << 8 | args[11];
+  uint8_t format = args[12];
+  if (!address) address = chip->memwr_symbol;
+  if (!address || x1 < x0 || y1 < y0 || format > MEMWR_RGB565_LE) {
+    printf("Warning: invalid MEMWR window %u,%u-%u,%u at 0x%08x format %u\n", x0, y0, x1, y1, address, format);
+    return;
+  }
+
+  set_address_range(chip, false, x0, x1);
+  set_address_range(chip, true, y0, y1);
+  CHIP_STAT_ADD(chip, windows, 1);
+  chip->perf.windows++;
+  CHIP_TIMELINE(chip, timeline_window_begin(chip, CMD_MEMWR));
+  CHIP_FRAME_LOG(chip, frame_log_window(chip));
+
+  uint8_t chunk[1024];
+  uint32_t remaining = (uint32_t)(x1 - x0 + 1) * (uint32_t)(y1 - y0 + 1) * 2;
+  while (remaining) {
+    uint32_t n = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+    if (!_mcu_read_memory((const void*)(uintptr_t)address, chunk, n)) {
+      printf("Warning: MEMWR could not read MCU memory at 0x%08x\n", address);
+      return;
+    }
+    if (format == MEMWR_RGB565_LE) {
+      for (uint32_t i = 0; i < n; i += 2) {
+        uint8_t lo = chunk[i];
+        chunk[i] = chunk[i + 1];
+        chunk[i + 1] = lo;
+      }
+    }
+    process_data(chip, chunk, n);
+    address += n;
+    remaining -= n;
+  }
+  CHIP_TIMELINE(chip, timeline_window_end(chip));
+}
+
+/* Simulation-only commands, only reached with the vendorCommands attr set */
+static void execute_vendor_command(chip_state_t *chip) {
   switch (chip->command_code) {
-    case CMD_NOP:
+    case CMD_RLEWR:
+      memset(&chip->rle, 0, sizeof(chip->rle));
+      chip->rle_write = true;
+      CHIP_STAT_ADD(chip, windows, 1);
+      chip->perf.windows++;
+      CHIP_TIMELINE(chip, timeline_window_begin(chip, CMD_RLEWR));
+      CHIP_FRAME_LOG(chip, frame_log_window(chip));
       break;
 
-    case CMD_SLPIN:
-    case CMD_DISPOFF:
-      // Not implemented.
+    case CMD_MEMWR:
+      execute_memwr(chip);
       break;
 
-    case CMD_SLPOUT:
-    case CMD_DISPON:
-      // Not implemented.
+    case CMD_CRCRD:
+      execute_crcrd(chip);
       break;
 
-    case CMD_INVOFF:
-    case CMD_INVON:
-      // Not implemented.
+    case CMD_PERFRD:
+      execute_perfrd(chip);
       break;
 
+    case CMD_RECTCP:
+      execute_rectcp(chip);
+      break;
+  }
+}
+
+/* COLMOD: switch RAMWR between 16-bit and 18-bit pixels */
+static void set_pixel_format(chip_state_t *chip, uint8_t colmod) {
+  uint8_t format = colmod & 0x0f;
+  if (!(chip->controller->color_formats & (1 << format))) {
+    printf("Warning: %s does not support COLMOD 0x%02x\n", chip->controller->name, colmod);
+    return;
+  }
+  chip->pixel_bytes = format == COLMOD_RGB666 ? 3 : 2;
+  chip->pixel_carry_length = 0;
+}
+
+void execute_command(chip_state_t *chip) {
+  CHIP_STAT_ADD(chip, commands, 1);
+  CHIP_TRACE(chip, "[%llu ns] cmd 0x%02x args %u\n", (unsigned long long)get_sim_nanos(),
+             chip->command_code, chip->command_size);
+  CHIP_TIMELINE(chip, timeline_add(chip, TIMELINE_COMMAND, get_sim_nanos(), 0, 0, chip->command_code));
+  CHIP_FRAME_LOG(chip, chip->frame_log->commands++);
+  if (command_is_vendor(chip->command_code) && chip->vendor_commands) {
+    execute_vendor_command(chip);
+    return;
+  }
+  if (!(chip->controller->commands[chip->command_code] & CMD_KNOWN)) {
+    printf("Warning: unknown command 0x%02x\n", chip->command_code);
+    return;
+  }
+  switch (chip->command_code) {
     case CMD_RAMWR:
       chip->ram_write = true;
+      chip->pixel_carry_length = 0;
+      CHIP_STAT_ADD(chip, windows, 1);
+      chip->perf.windows++;
+      CHIP_TIMELINE(chip, timeline_window_begin(chip, CMD_RAMWR));
+      CHIP_FRAME_LOG(chip, frame_log_window(chip));
       break;
 
     case CMD_MADCTL:
@@ -250,46 +1958,54 @@ void execute_command(chip_state_t *chip) {
       if (chip->command_size < 4) break;
       uint16_t arg0 = (chip->command_buf[0] << 8) | chip->command_buf[1];
       uint16_t arg2 = (chip->command_buf[2] << 8) | chip->command_buf[3];
-      bool set_page = chip->command_code == CMD_RASET;
-      if ((chip->scanning_direction & SCAN_MV) ? !set_page : set_page) {
-        chip->active_page = arg0;
-        chip->page_start = arg0;
-        chip->page_end = arg2;
-        if (chip->scanning_direction & SCAN_MY) {
-          // Some displays use offsets; keep simple and clamp
-          if (chip->page_start >= 32) chip->page_start -= 32;
-          if (chip->page_end >= 32) chip->page_end -= 32;
-          if (chip->active_page >= 32) chip->active_page -= 32;
-        }
-      } else {
-        chip->active_column = arg0;
-        chip->column_start = arg0;
-        chip->column_end = arg2;
-      }
+      set_address_range(chip, chip->command_code == CMD_RASET, arg0, arg2);
       break;
     }
 
-    case CMD_PWCTR1:
+    case CMD_COLMOD:
+      set_pixel_format(chip, chip->command_buf[0]);
+      break;
+
     case CMD_SWRESET:
+#if CHIP_FEATURE_PROFILES
+      chip_restart_fingerprint(chip);
+      chip_record_command(chip, CMD_SWRESET);
+#endif
+      chip->pixel_bytes = 2;
       chip_reset(chip);
       break;
 
-    case CMD_COLMOD:
-    case CMD_VMCTR:
-      // Not implemented.
+    case CMD_PWCTR1:
+      if (chip->controller->pwctr1_resets) chip_reset(chip);
       break;
 
     default:
-      printf("Warning: unknown command 0x%02x\n", chip->command_code);
+      // Power, timing and gamma settings: no effect on the simulated image
       break;
   }
 }
 
 void process_command(chip_state_t *chip, uint8_t *buffer, uint32_t buffer_size) {
+#if CHIP_FEATURE_GRAM
+  if ((chip->ram_write || chip->rle_write) && chip->present_policy == PRESENT_WINDOW) {
+    chip_present(chip);
+  }
+#endif
+#if CHIP_FEATURE_PROFILES
+  autotune_end_window(chip);
+#endif
+  CHIP_TIMELINE(chip, timeline_window_end(chip));
   chip->ram_write = false;
+  chip->rle_write = false;
   for (uint32_t i = 0; i < buffer_size; i++) {
     chip->command_code = buffer[i];
-    chip->command_size = command_args_size(chip->command_code);
+#if CHIP_FEATURE_PROFILES
+    chip_record_command(chip, chip->command_code);
+#endif
+#if CHIP_FEATURE_BOOT_REPORT
+    boot_record_command(chip, chip->command_code);
+#endif
+    chip->command_size = command_args_size(chip, chip->command_code);
     chip->command_index = 0;
     if (!chip->command_size) {
       execute_command(chip);
@@ -309,50 +2025,269 @@ void process_command_args(chip_state_t *chip, uint8_t *buffer, uint32_t buffer_s
   }
 }
 
+/* Map the current GRAM address to framebuffer coordinates; false if off-screen */
+static inline bool chip_map_address(chip_state_t *chip, int *out_x, int *out_y) {
+  int x = (int)chip->active_column;
+  int y = (int)chip->active_page;
+  if (chip->scanning_direction & SCAN_MV) {
+    x = (chip->scanning_direction & SCAN_MX) ? ((int)chip->width - 1 - x) : x;
+    y = (chip->scanning_direction & SCAN_MY) ? ((int)chip->height - 1 - y) : y;
+  } else {
+    x = (chip->scanning_direction & SCAN_MY) ? ((int)chip->width - 1 - x) : x;
+    y = (chip->scanning_direction & SCAN_MX) ? ((int)chip->height - 1 - y) : y;
+  }
+  *out_x = x;
+  *out_y = y;
+  return x >= 0 && x < (int)chip->width && y >= 0 && y < (int)chip->height;
+}
+
+/* Advance the write pointer in the configured order */
+static inline void chip_advance_address(chip_state_t *chip) {
+  if (chip->scanning_direction & SCAN_MV) {
+    chip->active_page++;
+    if (chip->active_page > chip->page_end) {
+      chip->active_page = chip->page_start;
+      chip->active_column++;
+      if (chip->active_column > chip->column_end) {
+        chip->active_column = chip->column_start;
+#if CHIP_FEATURE_GRAM
+        chip->window_wrapped = true;
+#endif
+      }
+    }
+  } else {
+    chip->active_column++;
+    if (chip->active_column > chip->column_end) {
+      chip->active_column = chip->column_start;
+      chip->active_page++;
+      if (chip->active_page > chip->page_end) {
+        chip->active_page = chip->page_start;
+#if CHIP_FEATURE_GRAM
+        chip->window_wrapped = true;
+#endif
+      }
+    }
+  }
+}
+
+static inline void chip_count_pixels(chip_state_t *chip, uint32_t pixels) {
+  CHIP_STAT_ADD(chip, pixels, pixels);
+  chip->perf.pixels += pixels;
+#if CHIP_FEATURE_PROFILES
+  chip->autotune.window_pixels += pixels;
+#endif
+  CHIP_TIMELINE(chip, chip->timeline->window_pixels += pixels);
+}
+
+/* Store one RGBA pixel at the current address (if on-screen) and advance */
+static inline void chip_put_pixel(chip_state_t *chip, uint32_t color) {
+  int x, y;
+  if (chip_map_address(chip, &x, &y)) {
+#if CHIP_FEATURE_GRAM
+    uint32_t *pixel = gram_pixel(chip, (uint32_t)x, (uint32_t)y);
+    // Only PERFRD reports redundant pixels, so only count them when it is available
+    if (chip->vendor_commands) chip->perf.redundant_pixels += *pixel == color;
+    *pixel = color;
+    gram_mark_dirty(chip, (uint32_t)x, (uint32_t)y, (uint32_t)x, (uint32_t)y);
+#else
+    if ((uint32_t)x >= chip->visible_x0 && (uint32_t)x <= chip->visible_x1 &&
+        (uint32_t)y >= chip->visible_y0 && (uint32_t)y <= chip->visible_y1) {
+      chip_write_host_row(chip, (uint32_t)y, (uint32_t)x, &color, 1);
+    }
+#endif
+  }
+  chip_advance_address(chip);
+}
+
+#if CHIP_FEATURE_GRAM
+/*
+ * In unmirrored row order the rest of the current window row is one ascending
+ * span in GRAM. Takes up to max pixels of it and advances the address past them.
+ * Returns the number of pixels taken, or 0 if the span fast path does not apply.
+ * *dst and *visible receive the on-screen part (visible may be 0).
+ */
+static uint32_t chip_take_row_span(chip_state_t *chip, uint32_t max, uint32_t **dst, uint32_t *visible) {
+  if ((chip->scanning_direction & (SCAN_MV | SCAN_MY)) ||
+      chip->active_column < chip->column_start || chip->active_column > chip->column_end) {
+    return 0;
+  }
+  uint32_t run = chip->column_end - chip->active_column + 1;
+  if (run > max) run = max;
+  int x, y;
+  chip_map_address(chip, &x, &y);
+  *visible = 0;
+  if (y >= 0 && y < (int)chip->height && x < (int)chip->width) {
+    if (chip->tile_cache) {
+      // Only the rest of the tile row is contiguous
+      uint32_t tile_left = (1u << TILE_SHIFT) - ((uint32_t)x & TILE_MASK);
+      if (run > tile_left) run = tile_left;
+    }
+    *visible = (uint32_t)x + run > chip->width ? chip->width - (uint32_t)x : run;
+    *dst = gram_pixel(chip, (uint32_t)x, (uint32_t)y);
+    gram_mark_dirty(chip, (uint32_t)x, (uint32_t)y, (uint32_t)x + *visible - 1, (uint32_t)y);
+  }
+  chip->active_column += run - 1;
+  chip_advance_address(chip);
+  return run;
+}
+#endif
+
 void process_data(chip_state_t *chip, const uint8_t *buf, uint32_t byte_count) {
   // Expecting 16-bit per pixel (RGB565) big-endian: hi, lo
   if (byte_count < 2) return;
   uint32_t pixels = byte_count / 2;
-  for (uint32_t i = 0; i < pixels; ++i) {
-    uint16_t val = (uint16_t)buf[2*i] << 8 | buf[2*i + 1];
-
-    int x = (int)chip->active_column;
-    int y = (int)chip->active_page;
-    if (chip->scanning_direction & SCAN_MV) {
-      x = (chip->scanning_direction & SCAN_MX) ? (chip->width - 1 - x) : x;
-      y = (chip->scanning_direction & SCAN_MY) ? (chip->height - 1 - y) : y;
-    } else {
-      x = (chip->scanning_direction & SCAN_MY) ? (chip->width - 1 - x) : x;
-      y = (chip->scanning_direction & SCAN_MX) ? (chip->height - 1 - y) : y;
+  chip_count_pixels(chip, pixels);
+
+  while (pixels) {
+#if CHIP_FEATURE_GRAM
+    uint32_t *dst, visible;
+    uint32_t run = chip_take_row_span(chip, pixels, &dst, &visible);
+    if (run) {
+      if (visible && chip->vendor_commands) {
+        for (uint32_t i = 0; i < visible; i++) {
+          chip->perf.redundant_pixels += dst[i] == rgb565_to_rgba((uint16_t)buf[i * 2] << 8 | buf[i * 2 + 1]);
+        }
+      }
+      if (visible) rgb565_span_to_rgba(buf, dst, visible);
+      buf += run * 2;
+      pixels -= run;
+      continue;
     }
+#endif
+    chip_put_pixel(chip, rgb565_to_rgba((uint16_t)buf[0] << 8 | buf[1]));
+    buf += 2;
+    pixels--;
+  }
+}
 
-    // Clamp coordinates to framebuffer
-    if (x < 0 || x >= (int)chip->width || y < 0 || y >= (int)chip->height) {
-      // advance pointers according to scanning direction, but skip write
-    } else {
-      uint32_t color = rgb565_to_rgba(val);
-      uint32_t pix_index = (uint32_t)y * chip->width + (uint32_t)x;
-      buffer_write(chip->framebuffer, pix_index * sizeof(color), &color, sizeof(color));
+/* Expand an 18-bit pixel (6 significant bits per byte, MSB aligned) to RGBA */
+static inline uint32_t rgb666_to_rgba(const uint8_t *src) {
+  uint32_t r8 = (src[0] & 0xfc) | (src[0] >> 6);
+  uint32_t g8 = (src[1] & 0xfc) | (src[1] >> 6);
+  uint32_t b8 = (src[2] & 0xfc) | (src[2] >> 6);
+  return 0xff000000u | (r8 << 16) | (g8 << 8) | b8;
+}
+
+/* RAMWR data after COLMOD 18-bit: three bytes per pixel, split anywhere across transfers */
+static void process_rgb666_data(chip_state_t *chip, const uint8_t *buf, uint32_t byte_count) {
+  if (chip->pixel_carry_length) {
+    while (chip->pixel_carry_length < 3 && byte_count) {
+      chip->pixel_carry[chip->pixel_carry_length++] = *buf++;
+      byte_count--;
     }
+    if (chip->pixel_carry_length < 3) return;
+    chip->pixel_carry_length = 0;
+    chip_count_pixels(chip, 1);
+    chip_put_pixel(chip, rgb666_to_rgba(chip->pixel_carry));
+  }
 
-    // Advance the write pointer in the configured order
-    if (chip->scanning_direction & SCAN_MV) {
-      chip->active_page++;
-      if (chip->active_page > chip->page_end) {
-        chip->active_page = chip->page_start;
-        chip->active_column++;
-        if (chip->active_column > chip->column_end) {
-          chip->active_column = chip->column_start;
-        }
+  uint32_t pixels = byte_count / 3;
+  chip_count_pixels(chip, pixels);
+  while (pixels) {
+#if CHIP_FEATURE_GRAM
+    uint32_t *dst, visible;
+    uint32_t run = chip_take_row_span(chip, pixels, &dst, &visible);
+    if (run) {
+      for (uint32_t i = 0; i < visible; i++) {
+        uint32_t color = rgb666_to_rgba(buf + i * 3);
+        if (chip->vendor_commands) chip->perf.redundant_pixels += dst[i] == color;
+        dst[i] = color;
       }
-    } else {
-      chip->active_column++;
-      if (chip->active_column > chip->column_end) {
-        chip->active_column = chip->column_start;
-        chip->active_page++;
-        if (chip->active_page > chip->page_end) {
-          chip->active_page = chip->page_start;
+      buf += run * 3;
+      pixels -= run;
+      continue;
+    }
+#endif
+    chip_put_pixel(chip, rgb666_to_rgba(buf));
+    buf += 3;
+    pixels--;
+  }
+
+  chip->pixel_carry_length = byte_count % 3;
+  memcpy(chip->pixel_carry, buf, chip->pixel_carry_length);
+}
+
+/* Write the same RGB565 value to pixel_count consecutive addresses */
+void fill_pixels(chip_state_t *chip, uint16_t value, uint32_t pixel_count) {
+  uint32_t color = rgb565_to_rgba(value);
+  chip_count_pixels(chip, pixel_count);
+
+  while (pixel_count) {
+#if CHIP_FEATURE_GRAM
+    uint32_t *dst, visible;
+    uint32_t run = chip_take_row_span(chip, pixel_count, &dst, &visible);
+    if (run) {
+      if (chip->vendor_commands) {
+        for (uint32_t i = 0; i < visible; i++) chip->perf.redundant_pixels += dst[i] == color;
+      }
+      for (uint32_t i = 0; i < visible; i++) dst[i] = color;
+      pixel_count -= run;
+      continue;
+    }
+#endif
+    chip_put_pixel(chip, color);
+    pixel_count--;
+  }
+}
+
+/*
+ * RLE pixel stream (vendor command RLEWR)
+ *
+ * The payload is a sequence of packets, each starting with a big-endian 16-bit
+ * header. Bit 15 set: a run of (header & 0x7fff) + 1 pixels of the RGB565 value
+ * that follows. Bit 15 clear: (header & 0x7fff) + 1 literal RGB565 pixels follow.
+ * Packets may be split anywhere across SPI transfers.
+ */
+void process_rle_data(chip_state_t *chip, const uint8_t *buf, uint32_t byte_count) {
+  rle_state_t *rle = &chip->rle;
+  while (byte_count) {
+    switch (rle->phase) {
+      case RLE_HEADER:
+        rle->header = (rle->header << 8) | *buf++;
+        byte_count--;
+        if (++rle->header_bytes == 2) {
+          rle->header_bytes = 0;
+          rle->remaining = (rle->header & 0x7fff) + 1;
+          rle->phase = (rle->header & 0x8000) ? RLE_RUN : RLE_LITERAL;
+          rle->header = 0;
+        }
+        break;
+
+      case RLE_RUN:
+        rle->pixel = (rle->pixel << 8) | *buf++;
+        byte_count--;
+        if (++rle->pixel_bytes == 2) {
+          fill_pixels(chip, (uint16_t)rle->pixel, rle->remaining);
+          rle->pixel_bytes = 0;
+          rle->pixel = 0;
+          rle->phase = RLE_HEADER;
+        }
+        break;
+
+      case RLE_LITERAL: {
+        if (rle->pixel_bytes) {
+          // Complete a pixel split across transfers
+          uint8_t pair[2] = { (uint8_t)rle->pixel, *buf++ };
+          byte_count--;
+          process_data(chip, pair, 2);
+          rle->pixel_bytes = 0;
+          if (--rle->remaining == 0) rle->phase = RLE_HEADER;
+          break;
+        }
+        uint32_t pixels = byte_count / 2;
+        if (pixels > rle->remaining) pixels = rle->remaining;
+        if (pixels) {
+          process_data(chip, buf, pixels * 2);
+          buf += pixels * 2;
+          byte_count -= pixels * 2;
+          rle->remaining -= pixels;
+        } else {
+          rle->pixel = *buf++;
+          rle->pixel_bytes = 1;
+          byte_count--;
         }
+        if (rle->remaining == 0) rle->phase = RLE_HEADER;
+        break;
       }
     }
   }
@@ -360,12 +2295,36 @@ void process_data(chip_state_t *chip, const uint8_t *buf, uint32_t byte_count) {
 
 void chip_spi_done(void *user_data, uint8_t *buffer, uint32_t count) {
   chip_state_t *chip = (chip_state_t*)user_data;
+  if (chip->response_armed) {
+    // Dummy bytes clocked in while the response went out
+    chip->response_armed = false;
+    if (count && pin_read(chip->cs_pin) == LOW) chip_spi_arm(chip);
+    return;
+  }
   if (!count) return; // called from spi_stop probably
+  CHIP_STAT_ADD(chip, bytes, count);
+  chip->perf.bytes += count;
+  CHIP_TIMELINE(chip, chip->timeline->cs_bytes += count);
+  CHIP_FRAME_LOG(chip, {
+    chip->frame_log->bytes += count;
+    if (chip->mode == MODE_DATA && (chip->ram_write || chip->rle_write)) {
+      chip->frame_log->window_bytes[chip->frame_log->window_class] += count;
+    }
+  });
+#if CHIP_FEATURE_PROFILES
+  chip->autotune.cs_bytes += count;
+#endif
 
   if (chip->mode == MODE_DATA) {
     if (chip->ram_write) {
       // buffer contains raw pixel bytes
-      process_data(chip, buffer, count);
+      if (chip->pixel_bytes == 3) {
+        process_rgb666_data(chip, buffer, count);
+      } else {
+        process_data(chip, buffer, count);
+      }
+    } else if (chip->rle_write) {
+      process_rle_data(chip, buffer, count);
     } else {
       // these are arguments for the last command (e.g. CASET/RASET)
       process_command_args(chip, buffer, count);
@@ -375,8 +2334,337 @@ void chip_spi_done(void *user_data, uint8_t *buffer, uint32_t count) {
     process_command(chip, buffer, count);
   }
 
+#if CHIP_FEATURE_GRAM
+  if (chip->present_policy == PRESENT_CHUNK) chip_present(chip);
+  if (chip->present_policy == PRESENT_FRAME && chip->window_wrapped) {
+    if (chip_window_is_full_panel(chip)) chip_present_frame(chip);
+    chip->window_wrapped = false;
+  }
+#endif
+
   if (pin_read(chip->cs_pin) == LOW) {
     // Keep receiving until CS goes high
-    spi_start(chip->spi, chip->spi_buffer, sizeof(chip->spi_buffer));
+    chip_spi_arm(chip);
+  }
+}
+
+
+#if CHIP_FEATURE_TIMELINE
+/*
+ * Timeline export. Lines are prefixed with "TRACE " so they can be separated
+ * from the rest of the output, e.g. sed -n 's/^TRACE //p' > chip.json, and
+ * loaded into Perfetto or chrome://tracing (JSON array format).
+ */
+static void timeline_flush(chip_state_t *chip) {
+  timeline_t *timeline = chip->timeline;
+  static const char *const thread_names[] = { "SPI", "GRAM", "commands", "host" };
+  if (!timeline->started) {
+    timeline->started = true;
+    printf("TRACE [\n");
+    for (uint32_t tid = 0; tid < 4; tid++) {
+      printf("TRACE {\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+             tid, thread_names[tid]);
+    }
+  }
+  for (uint32_t i = 0; i < timeline->count; i++) {
+    const timeline_event_t *event = &timeline->events[i];
+    double ts = event->ts / 1000.0;
+    switch (event->type) {
+      case TIMELINE_CS:
+        printf("TRACE {\"name\":\"CS\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":0,"
+               "\"args\":{\"bytes\":%u}},\n", ts, event->dur / 1000.0, event->arg);
+        break;
+      case TIMELINE_WINDOW:
+        printf("TRACE {\"name\":\"0x%02x window\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,"
+               "\"args\":{\"pixels\":%u}},\n", event->code, ts, event->dur / 1000.0, event->arg);
+        break;
+      case TIMELINE_COMMAND:
+        printf("TRACE {\"name\":\"cmd 0x%02x\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":2},\n",
+               event->code, ts);
+        break;
+      case TIMELINE_PRESENT:
+        printf("TRACE {\"name\":\"present\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":3,"
+               "\"args\":{\"host_writes\":%u}},\n", ts, event->arg);
+        break;
+    }
+  }
+  timeline->count = 0;
+}
+
+static void timeline_add(chip_state_t *chip, timeline_type_t type, uint64_t ts, uint64_t dur, uint32_t arg, uint8_t code) {
+  timeline_t *timeline = chip->timeline;
+  if (timeline->count == TIMELINE_CAPACITY) timeline_flush(chip);
+  timeline_event_t *event = &timeline->events[timeline->count++];
+  event->ts = ts;
+  event->dur = dur;
+  event->arg = arg;
+  event->type = type;
+  event->code = code;
+}
+
+static void timeline_window_begin(chip_state_t *chip, uint8_t code) {
+  timeline_t *timeline = chip->timeline;
+  timeline->window_start = get_sim_nanos();
+  timeline->window_pixels = 0;
+  timeline->window_code = code;
+  timeline->window_open = true;
+}
+
+static void timeline_window_end(chip_state_t *chip) {
+  timeline_t *timeline = chip->timeline;
+  if (!timeline->window_open) return;
+  timeline->window_open = false;
+  timeline_add(chip, TIMELINE_WINDOW, timeline->window_start, get_sim_nanos() - timeline->window_start,
+               timeline->window_pixels, timeline->window_code);
+}
+#endif
+
+#if CHIP_FEATURE_FRAME_LOG
+/*
+ * Frame log: one line per frame with its bytes, commands and pixel windows by
+ * size class. A frame ends at CS high, or when a new window starts, once it
+ * contains pixel data and has lasted at least one 60 Hz period.
+ */
+#define FRAME_LOG_PERIOD_NS (16666667ull)
+
+static void frame_log_boundary(chip_state_t *chip) {
+  frame_log_t *log = chip->frame_log;
+  uint64_t now = get_sim_nanos();
+  if (!log->pixels || now - log->start_ns < FRAME_LOG_PERIOD_NS) return;
+  printf("st7789 frame %u at %.1f ms: bytes %u commands %u tiny %u (%u B) partial %u (%u B) full %u (%u B)\n",
+         log->number, log->start_ns / 1e6, log->bytes, log->commands,
+         log->windows[WINDOW_TINY], log->window_bytes[WINDOW_TINY],
+         log->windows[WINDOW_PARTIAL], log->window_bytes[WINDOW_PARTIAL],
+         log->windows[WINDOW_FULL], log->window_bytes[WINDOW_FULL]);
+  uint32_t number = log->number + 1;
+  memset(log, 0, sizeof(*log));
+  log->number = number;
+  log->start_ns = now;
+}
+
+static void frame_log_window(chip_state_t *chip) {
+  frame_log_boundary(chip);
+  frame_log_t *log = chip->frame_log;
+  uint32_t columns = chip->column_end >= chip->column_start ? chip->column_end - chip->column_start + 1 : 0;
+  uint32_t rows = chip->page_end >= chip->page_start ? chip->page_end - chip->page_start + 1 : 0;
+  uint32_t area = columns * rows;
+  log->window_class = area <= 16 ? WINDOW_TINY : area >= chip->width * chip->height ? WINDOW_FULL : WINDOW_PARTIAL;
+  log->windows[log->window_class]++;
+  log->pixels = true;
+}
+#endif
+
+#if CHIP_FEATURE_STATS
+static void chip_stats_timer(void *user_data) {
+  chip_state_t *chip = (chip_state_t*)user_data;
+  CHIP_TIMELINE(chip, timeline_flush(chip));
+  chip_stats_t *now = &chip->stats;
+  chip_stats_t *last = &chip->stats_reported;
+  if (now->bytes == last->bytes && now->commands == last->commands) return;
+  printf("st7789 stats: bytes %llu (+%llu) commands %llu windows %llu pixels %llu host writes %llu",
+         (unsigned long long)now->bytes, (unsigned long long)(now->bytes - last->bytes),
+         (unsigned long long)now->commands, (unsigned long long)now->windows,
+         (unsigned long long)now->pixels, (unsigned long long)now->host_writes);
+#if CHIP_FEATURE_GRAM
+  printf(" presents %llu profile %s switches %llu\n",
+         (unsigned long long)now->presents, chip->profile->name, (unsigned long long)now->profile_switches);
+  if (chip->tile_cache) {
+    uint64_t hits = now->tile_hits - last->tile_hits;
+    uint64_t misses = now->tile_misses - last->tile_misses;
+    printf("st7789 stats: tile cache hit rate %.1f%% (+%llu misses, %llu read from the host, "
+           "%llu early writes) compressed %u bytes\n",
+           hits + misses ? 100.0 * hits / (hits + misses) : 100.0, (unsigned long long)misses,
+           (unsigned long long)(now->tile_host_reads - last->tile_host_reads),
+           (unsigned long long)(now->tile_early_writes - last->tile_early_writes),
+           chip->tile_cache->compressed_bytes);
+  }
+#else
+  printf("\n");
+#endif
+  *last = *now;
+}
+#endif
+
+#if CHIP_FEATURE_BENCH
+/*
+ * Self-benchmark
+ *
+ * Feeds synthetic workloads straight into chip_spi_done(), exactly as the SPI
+ * peripheral would, and compares the wall time spent in the chip with the
+ * simulated time the same bytes take on the bus at the configured SPI clock.
+ */
+
+typedef struct {
+  chip_state_t *chip;
+  uint64_t bytes;
+} bench_ctx_t;
+
+typedef struct {
+  const char *name;
+  uint8_t madctl;
+  void (*run)(bench_ctx_t *ctx);
+} bench_workload_t;
+
+static uint64_t bench_wall_nanos(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_feed(bench_ctx_t *ctx, chip_mode_t mode, const uint8_t *data, uint32_t count) {
+  chip_state_t *chip = ctx->chip;
+  chip->mode = mode;
+  while (count) {
+    uint32_t chunk = count < chip->spi_chunk ? count : chip->spi_chunk;
+    if (mode == MODE_DATA && chip->ram_write) {
+      // Split like chip_spi_arm() does, at window ends
+      uint32_t left = chip_window_bytes_left(chip);
+      if (left && left < chunk) chunk = left;
+    }
+    memcpy(chip->spi_buffer, data, chunk);
+    chip_spi_done(chip, chip->spi_buffer, chunk);
+    ctx->bytes += chunk;
+    data += chunk;
+    count -= chunk;
+  }
+}
+
+static void bench_command(bench_ctx_t *ctx, uint8_t command, const uint8_t *args, uint32_t arg_count) {
+  bench_feed(ctx, MODE_COMMAND, &command, 1);
+  if (arg_count) {
+    bench_feed(ctx, MODE_DATA, args, arg_count);
+  }
+}
+
+static void bench_window(bench_ctx_t *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+  const uint8_t caset[4] = { x0 >> 8, x0 & 0xff, x1 >> 8, x1 & 0xff };
+  const uint8_t raset[4] = { y0 >> 8, y0 & 0xff, y1 >> 8, y1 & 0xff };
+  bench_command(ctx, CMD_CASET, caset, sizeof(caset));
+  bench_command(ctx, CMD_RASET, raset, sizeof(raset));
+  bench_command(ctx, CMD_RAMWR, NULL, 0);
+}
+
+/* Stream pixel_count pixels; a zero step gives a solid fill, otherwise a gradient */
+static void bench_pixels(bench_ctx_t *ctx, uint16_t color, uint16_t step, uint32_t pixel_count) {
+  uint8_t chunk[512];
+  while (pixel_count) {
+    uint32_t n = pixel_count < sizeof(chunk) / 2 ? pixel_count : sizeof(chunk) / 2;
+    for (uint32_t i = 0; i < n; i++) {
+      chunk[2*i] = color >> 8;
+      chunk[2*i + 1] = color & 0xff;
+      color += step;
+    }
+    bench_feed(ctx, MODE_DATA, chunk, n * 2);
+    pixel_count -= n;
+  }
+}
+
+static void bench_full_frame(bench_ctx_t *ctx) {
+  chip_state_t *chip = ctx->chip;
+  bench_window(ctx, 0, 0, chip->width - 1, chip->height - 1);
+  bench_pixels(ctx, 0, 0x0821, chip->width * chip->height);
+}
+
+static void bench_fill(bench_ctx_t *ctx) {
+  chip_state_t *chip = ctx->chip;
+  bench_window(ctx, 0, 0, chip->width - 1, chip->height - 1);
+  bench_pixels(ctx, 0xf800, 0, chip->width * chip->height);
+}
+
+static void bench_single_pixels(bench_ctx_t *ctx) {
+  chip_state_t *chip = ctx->chip;
+  for (uint32_t i = 0; i < 4096; i++) {
+    uint16_t x = (i * 7) % chip->width;
+    uint16_t y = (i * 13) % chip->height;
+    bench_window(ctx, x, y, x, y);
+    bench_pixels(ctx, (uint16_t)i, 0, 1);
+  }
+}
+
+/* Software scroll: every row is redrawn as its own full-width window */
+static void bench_scroll(bench_ctx_t *ctx) {
+  chip_state_t *chip = ctx->chip;
+  for (uint32_t y = 0; y < chip->height; y++) {
+    bench_window(ctx, 0, y, chip->width - 1, y);
+    bench_pixels(ctx, (uint16_t)(y << 5), 1, chip->width);
+  }
+}
+
+static const bench_workload_t bench_workloads[] = {
+  { "full frame",         0x00, bench_full_frame },
+  { "fill",               0x00, bench_fill },
+  { "1x1 pixels",         0x00, bench_single_pixels },
+  { "scroll rows",        0x00, bench_scroll },
+  { "full frame MV|MX",   SCAN_MV | SCAN_MX, bench_full_frame },
+  { "full frame MY|MX",   SCAN_MY | SCAN_MX, bench_full_frame },
+  { "full frame MV|MY",   SCAN_MV | SCAN_MY, bench_full_frame },
+};
+
+static void chip_self_benchmark(chip_state_t *chip, uint32_t iterations, uint32_t spi_mhz) {
+  bench_ctx_t ctx = { .chip = chip };
+  if (!spi_mhz) spi_mhz = 40;
+#if CHIP_FEATURE_PROFILES
+  // Synthetic traffic says nothing about the firmware's driver
+  chip->fingerprinted = true;
+#endif
+#if CHIP_FEATURE_BOOT_REPORT
+  chip->boot.done = true;
+#endif
+#if CHIP_FEATURE_TIMELINE
+  // Keep the synthetic traffic out of the trace; a full buffer would be printed mid-run
+  timeline_t *timeline = chip->timeline;
+  chip->timeline = NULL;
+#endif
+
+  printf("st7789 self-benchmark (%s): %u iteration(s), SPI %u MHz\n", CHIP_VARIANT_NAME, iterations, spi_mhz);
+  printf("%-18s %10s %10s %10s %10s\n", "workload", "bytes", "wall ms", "sim ms", "x realtime");
+
+  for (uint32_t w = 0; w < sizeof(bench_workloads) / sizeof(bench_workloads[0]); w++) {
+    const bench_workload_t *workload = &bench_workloads[w];
+    chip_reset(chip);
+    ctx.bytes = 0;
+    bench_command(&ctx, CMD_MADCTL, &workload->madctl, 1);
+
+    uint64_t start = bench_wall_nanos();
+    for (uint32_t i = 0; i < iterations; i++) {
+      workload->run(&ctx);
+    }
+    uint64_t wall_ns = bench_wall_nanos() - start;
+    // 8 SPI clocks per byte
+    uint64_t sim_ns = ctx.bytes * 8 * 1000 / spi_mhz;
+
+    printf("%-18s %10llu %10.3f %10.3f %10.2f\n", workload->name,
+           (unsigned long long)ctx.bytes, wall_ns / 1e6, sim_ns / 1e6,
+           wall_ns ? (double)sim_ns / wall_ns : 0.0);
+  }
+
+  // Leave the chip as a freshly initialized one
+  chip_reset(chip);
+  chip->mode = MODE_COMMAND;
+  chip->command_code = 0;
+  chip->command_size = 0;
+  chip->command_index = 0;
+  chip_clear_framebuffer(chip);
+#if CHIP_FEATURE_PROFILES
+  chip_restart_fingerprint(chip);
+  chip_apply_profile(chip, &pipeline_profiles[PROFILE_DEFAULT]);
+#endif
+#if CHIP_FEATURE_BOOT_REPORT
+  boot_restart(chip);
+#endif
+  CHIP_FRAME_LOG(chip, memset(chip->frame_log, 0, sizeof(frame_log_t)));
+  memset(&chip->perf, 0, sizeof(chip->perf));
+#if CHIP_FEATURE_STATS
+  memset(&chip->stats, 0, sizeof(chip->stats));
+  memset(&chip->stats_reported, 0, sizeof(chip->stats_reported));
+#endif
+#if CHIP_FEATURE_TIMELINE
+  chip->timeline = timeline;
+  if (timeline) {
+    timeline->count = 0;
+    timeline->cs_bytes = 0;
+    timeline->window_open = false;
   }
+#endif
 }
+#endif
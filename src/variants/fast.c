@@ -0,0 +1,6 @@
+// st7789 chip, fast variant (see src/chip-config.h)
+//
+// SPDX-License-Identifier: MIT
+
+#define CHIP_VARIANT_FAST
+#include "../main.c"
@@ -0,0 +1,6 @@
+// st7789 chip, instrumented variant (see src/chip-config.h)
+//
+// SPDX-License-Identifier: MIT
+
+#define CHIP_VARIANT_INSTRUMENTED
+#include "../main.c"